@@ -3,6 +3,7 @@
 #include "hscore.h"
 #include "hs_fields.h"
 #include <string.h>
+#include <strings.h> // strcasecmp
 #include <math.h>
 
 #define MODULE_NAME "hs_attackfields"
@@ -11,11 +12,75 @@ local Imodman *mm;
 local Ilogman *lm;
 local Iconfig *cfg;
 local Iplayerdata *pd;
+local Iarenaman *aman;
 local Igame *game;
 local Inet *net;
 local Iprng *prng;
 local Ihsfields *fields;
 
+/**
+ * How an attack field picks its targets when more than maxtargets enemies are inside.
+ */
+enum AttackPriority {
+    PriorityClosest = 0,
+    PriorityEnergy,
+    PriorityLongest
+};
+
+/**
+ * The most targets a field type can be limited to.
+ */
+#define MAX_TARGETS 32
+
+/**
+ * A candidate target. Lower scores are better.
+ */
+typedef struct AttackTarget {
+    int index;
+    int pid;
+    int64_t score;
+} AttackTarget;
+
+/**
+ * When a player entered the field, stored in inst->data by player name.
+ */
+typedef struct AttackEntry {
+    ticks_t entered;
+    ticks_t seen;
+} AttackEntry;
+
+/**
+ * Weapon budget settings for an arena.
+ */
+typedef struct AttackArenaData {
+    /**
+     * Field weapon packets a victim may receive per second, summed over every attack field. 0 for no limit.
+     */
+    int victimPacketRate;
+    
+    /**
+     * How many packets a victim can take at once after a quiet period.
+     */
+    int victimPacketBurst;
+} AttackArenaData;
+local int adkey;
+
+/**
+ * Per-player weapon budget. Only touched by the update job of the player's arena.
+ */
+typedef struct AttackPlayerData {
+    /**
+     * Packets the player can still be sent, in hundredths so each tick refills a whole number.
+     */
+    int tokens;
+    
+    /**
+     * When tokens was last refilled. 0 if the bucket was never used.
+     */
+    ticks_t lastRefill;
+} AttackPlayerData;
+local int pdkey;
+
 /*********************************/
 
 /**
@@ -59,44 +124,191 @@ local int DetermineRotation(int xspeed, int yspeed) {
 }
 
 /**
- * Fires the field weapon at the victim. Clears the fake player position to try to stay out of the way.
+ * Returns what a 16 bit packet field adds to the XOR checksum of a weapon packet.
+ */
+local inline u8 XorWord(u16 value) {
+    return (value ^ (value >> 8)) & 0xFF;
+}
+
+/**
+ * Builds a weapon packet with only the fields that are the same for every shot of a field type filled in.
+ * The checksum covers just those fields, so each shot only has to add in the bytes it sets.
+ */
+local struct S2CWeapons *BuildPacketTemplate(const struct Weapons *wpn) {
+    struct S2CWeapons *packet = amalloc(sizeof(struct S2CWeapons));
+
+    packet->type = S2C_WEAPON;
+    packet->status = STATUS_STEALTH | STATUS_CLOAK | STATUS_UFO;
+    packet->bounty = 10;
+    packet->weapon = *wpn;
+
+    game->DoWeaponChecksum(packet);
+
+    return packet;
+}
+
+/**
+ * Fires the field weapon at the victim, then moves the fake player away on the victim's screen so they don't hit it.
+ * The packets carry the position, so the fake player itself is never moved. That would race the other updates.
  */
-local void FireWeapon(Player *victim, HSFieldInstance *inst) {
-    unsigned status = STATUS_STEALTH | STATUS_CLOAK | STATUS_UFO;
-    struct S2CWeapons packet = {
-        S2C_WEAPON, victim->position.rotation, current_ticks() & 0xFFFF, victim->position.x, victim->position.yspeed,
-        inst->fake->pid, victim->position.xspeed, 0, status, 0,
-        victim->position.y, 10
-    };
+local void FireWeapon(const HSFieldSnapshot *snap, int victim, HSFieldInstance *inst) {
+    const struct S2CWeapons *fire = HashGetOne(inst->type->properties, "packet");
+    const struct S2CWeapons *clear = HashGetOne(inst->type->properties, "clearpacket");
+    int *track = (int *)HashGetOne(inst->type->properties, "track");
+    struct S2CWeapons packet;
 
-    int *track = (int *)HashGetOne(&inst->type->properties, "track");
+    // The fake player couldn't be created, so there is nobody to fire as
+    if (!inst->fake)
+        return;
+
+    packet = *fire;
+
+    packet.time = current_ticks() & 0xFFFF;
+    packet.x = snap->x[victim];
+    packet.y = snap->y[victim];
+    packet.xspeed = snap->xspeed[victim];
+    packet.yspeed = snap->yspeed[victim];
+    packet.playerid = inst->fake->pid;
 
     if (track && *track)
         packet.rotation = DetermineRotation(packet.xspeed, packet.yspeed);
     else
         packet.rotation = RandomRotation();
 
-    inst->fake->position.x = packet.x;
-    inst->fake->position.y = packet.y;
+    packet.checksum = fire->checksum ^ (u8)packet.rotation ^ XorWord(packet.time) ^ XorWord(packet.x) ^ XorWord(packet.y) ^
+        XorWord(packet.xspeed) ^ XorWord(packet.yspeed) ^ XorWord(packet.playerid);
 
-    packet.weapon = *((struct Weapons *)HashGetOne(&inst->type->properties, "weapon"));
-
-    game->DoWeaponChecksum(&packet);
-    net->SendToOne(victim, (byte *)&packet, sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData), NET_RELIABLE);
+    fields->SendToOne(inst, snap->players[victim], (byte *)&packet, sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData), NET_RELIABLE);
+    HS_FIELD_TRACE(fields, inst, TraceFireWeapon, snap->pid[victim], sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData));
 
     // Clear fake player position so players don't hit it with their own weapons
-    packet.x = 0;
-    packet.y = 0;
-    packet.xspeed = 0;
-    packet.yspeed = 0;
-    packet.rotation = 0;
-    packet.weapon.type = W_NULL;
-    packet.time = TICK_MAKE(packet.time + 1) & 0xFFFF;
-    inst->fake->position.x = 0;
-    inst->fake->position.y = 0;
-
-    game->DoWeaponChecksum(&packet);
-    net->SendToOne(victim, (byte *)&packet, sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData), NET_RELIABLE);
+    u16 time = TICK_MAKE(packet.time + 1) & 0xFFFF;
+
+    packet = *clear;
+    packet.time = time;
+    packet.playerid = inst->fake->pid;
+    packet.checksum = clear->checksum ^ XorWord(packet.time) ^ XorWord(packet.playerid);
+
+    fields->SendToOne(inst, snap->players[victim], (byte *)&packet, sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData), NET_RELIABLE);
+
+    fields->AddStat(inst->arena, StatWeaponPackets, 2);
+    fields->AddStat(inst->arena, StatWeaponBytes, 2 * (sizeof(struct S2CWeapons) - sizeof(struct ExtraPosData)));
+    fields->RecordHit(inst, snap->x[victim], snap->y[victim]);
+}
+
+/**
+ * Checks if target a is worse than target b. Ties go to the higher pid so the choice doesn't depend on player order.
+ */
+local inline int TargetWorse(const AttackTarget *a, const AttackTarget *b) {
+    if (a->score != b->score)
+        return a->score > b->score;
+    return a->pid > b->pid;
+}
+
+/**
+ * Restores the max-heap order by moving the root down. The worst kept target stays at the root.
+ */
+local void TargetSiftDown(AttackTarget *heap, int count) {
+    int i = 0;
+
+    while (1) {
+        int worst = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < count && TargetWorse(&heap[left], &heap[worst]))
+            worst = left;
+        if (right < count && TargetWorse(&heap[right], &heap[worst]))
+            worst = right;
+        if (worst == i)
+            break;
+
+        AttackTarget tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+/**
+ * Keeps the best max targets seen so far. Once the heap is full, a new target only goes in by replacing the worst one.
+ */
+local void TargetOffer(AttackTarget *heap, int *count, int max, const AttackTarget *target) {
+    if (*count < max) {
+        int i = (*count)++;
+
+        heap[i] = *target;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+
+            if (!TargetWorse(&heap[i], &heap[parent]))
+                break;
+
+            AttackTarget tmp = heap[i];
+            heap[i] = heap[parent];
+            heap[parent] = tmp;
+            i = parent;
+        }
+    } else if (TargetWorse(&heap[0], target)) {
+        heap[0] = *target;
+        TargetSiftDown(heap, *count);
+    }
+}
+
+/**
+ * Updates when the player entered the field and returns how many ticks they have been inside.
+ * Entries that weren't seen on the last few updates are from an earlier visit and start over.
+ */
+local int TimeInside(HSFieldInstance *inst, Player *p, ticks_t now) {
+    AttackEntry *entry = HashGetOne(inst->data, p->name);
+
+    if (!entry) {
+        entry = amalloc(sizeof(AttackEntry));
+        entry->entered = now;
+        HashAdd(inst->data, p->name, entry);
+    } else if (TICK_DIFF(now, entry->seen) > inst->type->delay * 2) {
+        entry->entered = now;
+    }
+
+    entry->seen = now;
+    return TICK_DIFF(now, entry->entered);
+}
+
+/**
+ * Takes the packets for one shot out of the victim's budget. Returns 0 if the shot has to be dropped.
+ */
+local int TakeShotBudget(HSFieldInstance *inst, Player *victim, ticks_t now) {
+    AttackArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+    AttackPlayerData *pdata = PPDATA(victim, pdkey);
+    int burst = adata->victimPacketBurst * 100;
+    int cost = 2 * 100;
+
+    if (!adata->victimPacketRate)
+        return 1;
+
+    if (!pdata->lastRefill) {
+        pdata->tokens = burst;
+    } else {
+        // Packets per second become hundredths of a packet per tick
+        int64_t tokens = pdata->tokens + (int64_t)TICK_DIFF(now, pdata->lastRefill) * adata->victimPacketRate;
+        pdata->tokens = tokens > burst ? burst : (int)tokens;
+    }
+    pdata->lastRefill = now;
+
+    if (pdata->tokens < cost)
+        return 0;
+
+    pdata->tokens -= cost;
+    return 1;
+}
+
+/**
+ * Fires at the victim if they have budget left, otherwise counts the shot as suppressed.
+ */
+local void FireWithinBudget(const HSFieldSnapshot *snap, int victim, HSFieldInstance *inst) {
+    if (TakeShotBudget(inst, snap->players[victim], snap->tick))
+        FireWeapon(snap, victim, inst);
+    else
+        fields->AddStat(inst->arena, StatSuppressedShots, 1);
 }
 
 /**
@@ -170,11 +382,46 @@ local void AttackPropertyLoader(Arena *arena, const char *section, HashTable *pr
 
     HashAdd(properties, "weapon", wpn);
 
+    // Every shot is sent as a copy of these with the per-shot fields patched in
+    struct Weapons none = *wpn;
+
+    none.type = W_NULL;
+
+    HashAdd(properties, "packet", BuildPacketTemplate(wpn));
+    HashAdd(properties, "clearpacket", BuildPacketTemplate(&none));
+
     int *track = amalloc(sizeof(int));
 
     *track = cfg->GetInt(arena->cfg, section, "track", 0);
 
     HashAdd(properties, "track", track);
+
+    // 0 fires at every enemy inside
+    int *maxTargets = amalloc(sizeof(int));
+
+    *maxTargets = cfg->GetInt(arena->cfg, section, "maxtargets", 0);
+    if (*maxTargets < 0 || *maxTargets > MAX_TARGETS) {
+        lm->LogA(L_WARN, MODULE_NAME, arena, "%s maxtargets must be between 0 and %d.", section, MAX_TARGETS);
+        *maxTargets = *maxTargets < 0 ? 0 : MAX_TARGETS;
+    }
+
+    HashAdd(properties, "maxtargets", maxTargets);
+
+    const char *priorityName = cfg->GetStr(arena->cfg, section, "targetpriority");
+    int *priority = amalloc(sizeof(int));
+
+    if (!priorityName || !strcasecmp(priorityName, "closest"))
+        *priority = PriorityClosest;
+    else if (!strcasecmp(priorityName, "energy"))
+        *priority = PriorityEnergy;
+    else if (!strcasecmp(priorityName, "longest"))
+        *priority = PriorityLongest;
+    else {
+        lm->LogA(L_WARN, MODULE_NAME, arena, "%s has unknown targetpriority %s, using closest.", section, priorityName);
+        *priority = PriorityClosest;
+    }
+
+    HashAdd(properties, "targetpriority", priority);
 }
 
 /**
@@ -182,48 +429,115 @@ local void AttackPropertyLoader(Arena *arena, const char *section, HashTable *pr
  */
 local void AttackPropertyCleanup(Arena *arena, HashTable *properties) {
     struct Weapons *wpn = HashGetOne(properties, "weapon");
+    struct S2CWeapons *packet = HashGetOne(properties, "packet");
+    struct S2CWeapons *clearPacket = HashGetOne(properties, "clearpacket");
     int *track = HashGetOne(properties, "track");
+    int *maxTargets = HashGetOne(properties, "maxtargets");
+    int *priority = HashGetOne(properties, "targetpriority");
 
     HashRemoveAny(properties, "weapon");
+    HashRemoveAny(properties, "packet");
+    HashRemoveAny(properties, "clearpacket");
     HashRemoveAny(properties, "track");
+    HashRemoveAny(properties, "maxtargets");
+    HashRemoveAny(properties, "targetpriority");
 
     afree(wpn);
+    afree(packet);
+    afree(clearPacket);
     afree(track);
+    afree(maxTargets);
+    afree(priority);
 }
 
 /**
  * Called when a field instance is created.
  */
 local void AttackInstanceConstructor(HSFieldInstance *inst) {
-    
+    inst->data = HashAlloc();
 }
 
 /**
  * Called when a field instance gets updated. Fires weapons at enemies.
  */
 local void AttackInstanceUpdate(HSFieldInstance *inst) {
-    Player *p;
-    Link *link;
-
-    pd->Lock();
-    FOR_EACH_PLAYER_IN_ARENA(p, inst->arena) {
-        if (HS_IS_SPEC(p))
-            continue;
-        if (HS_IS_ON_FREQ(p, inst->arena, inst->player->pkt.freq))
+    const HSFieldSnapshot *snap = fields->GetSnapshot(inst->arena);
+    int maxTargets = *(int *)HashGetOne(inst->type->properties, "maxtargets");
+    int priority = *(int *)HashGetOne(inst->type->properties, "targetpriority");
+    AttackTarget heap[MAX_TARGETS];
+    int count = 0;
+
+    HS_FOR_ENEMY_FREQ(snap, inst->freq, i) {
+        if (!HS_IN_FIELD(inst, snap, i)) {
+            if (priority == PriorityLongest) {
+                AttackEntry *entry = HashGetOne(inst->data, snap->players[i]->name);
+                if (entry) {
+                    HashRemove(inst->data, snap->players[i]->name, entry);
+                    afree(entry);
+                }
+            }
             continue;
-        if (p->flags.is_dead)
+        }
+
+        if (!maxTargets) {
+            FireWithinBudget(snap, i, inst);
             continue;
-      if (InSquare(p->arena, p->p_ship, inst->x, inst->y, inst->type->radius, p->position.x, p->position.y))
-          FireWeapon(p, inst);
+        }
+
+        AttackTarget target = { i, snap->pid[i], 0 };
+
+        switch (priority) {
+            case PriorityClosest:
+            {
+                int64_t dx = snap->x[i] - inst->x, dy = snap->y[i] - inst->y;
+                target.score = dx * dx + dy * dy;
+            }
+            break;
+            case PriorityEnergy:
+                target.score = snap->energy[i];
+            break;
+            case PriorityLongest:
+                target.score = -TimeInside(inst, snap->players[i], snap->tick);
+            break;
+        }
+
+        TargetOffer(heap, &count, maxTargets, &target);
     }
-    pd->Unlock();
+
+    for (int i = 0; i < count; i++)
+        FireWithinBudget(snap, heap[i].index, inst);
 }
 
 /**
  * Called when a field instance is destroyed.
  */
 void AttackInstanceDestructor(HSFieldInstance *inst) {
-    
+    HashEnum(inst->data, hash_enum_afree, NULL);
+    HashFree(inst->data);
+}
+
+/*******************************/
+
+/**
+ * Caches the weapon budget settings for the arena.
+ */
+local void LoadArenaConfig(Arena *arena) {
+    AttackArenaData *adata = P_ARENA_DATA(arena, adkey);
+
+    adata->victimPacketRate = cfg->GetInt(arena->cfg, "hs_attackfields", "VictimPacketRate", 0);
+    adata->victimPacketBurst = cfg->GetInt(arena->cfg, "hs_attackfields", "VictimPacketBurst", 20);
+
+    // A burst smaller than one shot would drop everything
+    if (adata->victimPacketBurst < 2)
+        adata->victimPacketBurst = 2;
+}
+
+/**
+ * Callback called when something happens to the arena. Reloads the cached config when it changes.
+ */
+local void OnArenaAction(Arena *arena, int action) {
+    if (action == AA_CONFCHANGED)
+        LoadArenaConfig(arena);
 }
 
 /*******************************/
@@ -238,13 +552,14 @@ local int GetInterfaces(Imodman *mm_) {
         lm = mm->GetInterface(I_LOGMAN, ALLARENAS);
         cfg = mm->GetInterface(I_CONFIG, ALLARENAS);
         pd = mm->GetInterface(I_PLAYERDATA, ALLARENAS);
+        aman = mm->GetInterface(I_ARENAMAN, ALLARENAS);
         game = mm->GetInterface(I_GAME, ALLARENAS);
         net = mm->GetInterface(I_NET, ALLARENAS);
         prng = mm->GetInterface(I_PRNG, ALLARENAS);
         
         fields = mm->GetInterface(I_HSFIELDS, ALLARENAS);
 
-        return mm && lm && cfg && pd && game && net && prng && fields;
+        return mm && lm && cfg && pd && aman && game && net && prng && fields;
     }
 
     return 0;
@@ -258,6 +573,7 @@ local void ReleaseInterfaces() {
         mm->ReleaseInterface(lm);
         mm->ReleaseInterface(cfg);
         mm->ReleaseInterface(pd);
+        mm->ReleaseInterface(aman);
         mm->ReleaseInterface(game);
         mm->ReleaseInterface(net);
         mm->ReleaseInterface(prng);
@@ -267,12 +583,20 @@ local void ReleaseInterfaces() {
     }
 }
 
+/**
+ * The config keys read by AttackPropertyLoader.
+ */
+local const char * const attack_keys[] = {
+    "weapon", "track", "maxtargets", "targetpriority", NULL
+};
+
 HSFieldClass attack_class = {
     AttackPropertyLoader,
     AttackPropertyCleanup,
     AttackInstanceConstructor,
     AttackInstanceUpdate,
-    AttackInstanceDestructor
+    AttackInstanceDestructor,
+    attack_keys
 };
 
 EXPORT const char info_hs_attackfields[] = "v1.0 by monkey, based on hs_field v1.01 by Arnk Kilo Dylie <orbfighter@rshl.org>";
@@ -287,20 +611,40 @@ EXPORT int MM_hs_attackfields(int action, Imodman *mm_, Arena *arena) {
                 break;
             }
 
+            adkey = aman->AllocateArenaData(sizeof(AttackArenaData));
+            if (adkey == -1) {
+                lm->Log(L_ERROR, "<%s> Unable to allocate arena data.", MODULE_NAME);
+                ReleaseInterfaces();
+                break;
+            }
+
+            pdkey = pd->AllocatePlayerData(sizeof(AttackPlayerData));
+            if (pdkey == -1) {
+                aman->FreeArenaData(adkey);
+                lm->Log(L_ERROR, "<%s> Unable to allocate player data.", MODULE_NAME);
+                ReleaseInterfaces();
+                break;
+            }
+
             fields->RegisterFieldClass("attack", &attack_class);
             rv = MM_OK;
 
         break;
         case MM_ATTACH:
+            LoadArenaConfig(arena);
+            mm->RegCallback(CB_ARENAACTION, OnArenaAction, arena);
             rv = MM_OK;
 
         break;
         case MM_DETACH:
+            mm->UnregCallback(CB_ARENAACTION, OnArenaAction, arena);
             rv = MM_OK;
 
         break;
         case MM_UNLOAD:
             fields->UnregisterFieldClass("attack");
+            aman->FreeArenaData(adkey);
+            pd->FreePlayerData(pdkey);
             ReleaseInterfaces();
             rv = MM_OK;
 
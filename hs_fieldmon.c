@@ -0,0 +1,247 @@
+/**
+ * hs_fieldmon: prints live rates from the hs_fields shared memory stats segment.
+ * Standalone, does not need asss.
+ *
+ * Build: cc -O2 -o hs_fieldmon hs_fieldmon.c -lrt
+ * Usage: hs_fieldmon [-n shmname] [-i seconds] [-c count]
+ */
+#include "hs_fields_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+typedef struct Snapshot {
+    uint64_t created;
+    int32_t instancesUsed;
+    int32_t instancesPeak;
+    int arenaValid[HS_STATS_MAX_ARENAS];
+    HSStatsArena arenas[HS_STATS_MAX_ARENAS];
+    HSStatsClass classes[HS_STATS_MAX_CLASSES];
+} Snapshot;
+
+/**
+ * Returns the upper bound of a histogram bucket. Matches HistBucketValue in hs_fields.
+ */
+static uint64_t BucketValue(int bucket) {
+    if (bucket < 4)
+        return bucket;
+
+    int msb = (bucket >> 2) + 1;
+    return ((uint64_t)(4 | (bucket & 3)) + 1) << (msb - 2);
+}
+
+/**
+ * Returns the value at the given permille of the difference of two histograms.
+ */
+static uint64_t DeltaPercentile(const uint32_t *now, const uint32_t *then, int permille) {
+    uint64_t total = 0, seen = 0;
+
+    for (int i = 0; i < HS_STATS_HIST_BUCKETS; i++)
+        total += now[i] - then[i];
+
+    if (!total)
+        return 0;
+
+    uint64_t target = (total * permille + 999) / 1000;
+
+    for (int i = 0; i < HS_STATS_HIST_BUCKETS; i++) {
+        seen += now[i] - then[i];
+        if (seen >= target)
+            return BucketValue(i);
+    }
+
+    return BucketValue(HS_STATS_HIST_BUCKETS - 1);
+}
+
+/**
+ * Copies an arena slot. Retries while the seqlock shows the slot changing owner.
+ */
+static int ReadArena(const HSStatsArena *src, HSStatsArena *dest) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue;
+
+        dest->inUse = __atomic_load_n(&src->inUse, __ATOMIC_RELAXED);
+        memcpy(dest->name, src->name, sizeof(dest->name));
+        dest->name[sizeof(dest->name) - 1] = 0;
+        dest->live = __atomic_load_n(&src->live, __ATOMIC_RELAXED);
+        dest->fakes = __atomic_load_n(&src->fakes, __ATOMIC_RELAXED);
+        dest->backlog = __atomic_load_n(&src->backlog, __ATOMIC_RELAXED);
+
+        for (int i = 0; i < HS_STATS_COUNTERS; i++)
+            dest->stats[i] = __atomic_load_n(&src->stats[i], __ATOMIC_RELAXED);
+        for (int i = 0; i < HS_STATS_HIST_BUCKETS; i++)
+            dest->updateNs[i] = __atomic_load_n(&src->updateNs[i], __ATOMIC_RELAXED);
+        for (int i = 0; i < HS_STATS_HIST_BUCKETS; i++)
+            dest->tickNs[i] = __atomic_load_n(&src->tickNs[i], __ATOMIC_RELAXED);
+        for (int i = 0; i < HS_STATS_HIST_BUCKETS; i++)
+            dest->lateTicks[i] = __atomic_load_n(&src->lateTicks[i], __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq)
+            return dest->inUse;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies the class slots. Retries while a class is being added.
+ */
+static void ReadClasses(const HSStatsSegment *seg, HSStatsClass *dest) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue;
+
+        for (int i = 0; i < HS_STATS_MAX_CLASSES; i++) {
+            dest[i].inUse = __atomic_load_n(&seg->classes[i].inUse, __ATOMIC_RELAXED);
+            memcpy(dest[i].name, seg->classes[i].name, sizeof(dest[i].name));
+            dest[i].name[sizeof(dest[i].name) - 1] = 0;
+            dest[i].updates = __atomic_load_n(&seg->classes[i].updates, __ATOMIC_RELAXED);
+            dest[i].updateNs = __atomic_load_n(&seg->classes[i].updateNs, __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+static void TakeSnapshot(const HSStatsSegment *seg, Snapshot *snap) {
+    snap->created = seg->created;
+    snap->instancesUsed = __atomic_load_n(&seg->instancesUsed, __ATOMIC_RELAXED);
+    snap->instancesPeak = __atomic_load_n(&seg->instancesPeak, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < HS_STATS_MAX_ARENAS; i++)
+        snap->arenaValid[i] = ReadArena(&seg->arenas[i], &snap->arenas[i]);
+
+    ReadClasses(seg, snap->classes);
+}
+
+static void PrintRates(const Snapshot *now, const Snapshot *then, double seconds) {
+    printf("\ninstances %d (peak %d)\n", now->instancesUsed, now->instancesPeak);
+    printf("%-16s %5s %5s %8s %8s %9s %10s %10s %8s %7s %8s %9s %10s %8s %8s %8s %8s\n",
+        "arena", "live", "fakes", "spawn/s", "expire/s", "update/s", "p99 update", "p99 tick", "defer/s", "backlog", "p99 late",
+        "weapon/s", "bytes/s", "resend/s", "prize/s", "supp/s", "lvzmv/s");
+
+    for (int i = 0; i < HS_STATS_MAX_ARENAS; i++) {
+        const HSStatsArena *a = &now->arenas[i], *b = &then->arenas[i];
+
+        if (!now->arenaValid[i])
+            continue;
+
+        // A slot given to another arena since the last sample has no meaningful rates yet.
+        if (!then->arenaValid[i] || strcmp(a->name, b->name) != 0) {
+            printf("%-16s %5d %5d\n", a->name, a->live, a->fakes);
+            continue;
+        }
+
+        printf("%-16s %5d %5d %8.2f %8.2f %9.1f %8lluns %8lluns %8.2f %7d %8llu %9.1f %10.1f %8.2f %8.2f %8.2f %8.2f\n",
+            a->name, a->live, a->fakes,
+            (a->stats[StatSpawns] - b->stats[StatSpawns]) / seconds,
+            (a->stats[StatExpiries] - b->stats[StatExpiries]) / seconds,
+            (a->stats[StatUpdates] - b->stats[StatUpdates]) / seconds,
+            (unsigned long long)DeltaPercentile(a->updateNs, b->updateNs, 990),
+            (unsigned long long)DeltaPercentile(a->tickNs, b->tickNs, 990),
+            (a->stats[StatDeferredUpdates] - b->stats[StatDeferredUpdates]) / seconds,
+            a->backlog,
+            (unsigned long long)DeltaPercentile(a->lateTicks, b->lateTicks, 990),
+            (a->stats[StatWeaponPackets] - b->stats[StatWeaponPackets]) / seconds,
+            (a->stats[StatWeaponBytes] - b->stats[StatWeaponBytes]) / seconds,
+            (a->stats[StatOverrideResends] - b->stats[StatOverrideResends]) / seconds,
+            (a->stats[StatPrizeGrants] - b->stats[StatPrizeGrants]) / seconds,
+            (a->stats[StatSuppressedShots] - b->stats[StatSuppressedShots]) / seconds,
+            (a->stats[StatLVZMoves] - b->stats[StatLVZMoves]) / seconds);
+    }
+
+    printf("%-16s %9s %10s\n", "class", "update/s", "avg update");
+    for (int i = 0; i < HS_STATS_MAX_CLASSES; i++) {
+        const HSStatsClass *a = &now->classes[i], *b = &then->classes[i];
+        uint64_t updates = a->updates - b->updates;
+
+        if (!a->inUse)
+            continue;
+
+        printf("%-16s %9.1f %8lluns\n", a->name, updates / seconds,
+            (unsigned long long)(updates ? (a->updateNs - b->updateNs) / updates : 0));
+    }
+
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *name = HS_STATS_SHM_NAME;
+    int interval = 5, count = -1, opt;
+
+    while ((opt = getopt(argc, argv, "n:i:c:")) != -1) {
+        switch (opt) {
+            case 'n': name = optarg; break;
+            case 'i': interval = atoi(optarg); break;
+            case 'c': count = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n shmname] [-i seconds] [-c count]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (interval <= 0)
+        interval = 1;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        perror("shm_open");
+        return 1;
+    }
+
+    const HSStatsSegment *seg = mmap(NULL, sizeof(HSStatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (seg == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != HS_STATS_MAGIC || seg->version != HS_STATS_VERSION ||
+        seg->size != sizeof(HSStatsSegment)) {
+        fprintf(stderr, "%s is not a version %d hs_fields stats segment.\n", name, HS_STATS_VERSION);
+        return 1;
+    }
+
+    Snapshot *snaps = calloc(2, sizeof(Snapshot));
+    int cur = 0;
+
+    TakeSnapshot(seg, &snaps[cur]);
+
+    while (count != 0) {
+        sleep(interval);
+
+        if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != HS_STATS_MAGIC) {
+            fprintf(stderr, "The stats segment was closed.\n");
+            break;
+        }
+
+        TakeSnapshot(seg, &snaps[cur ^ 1]);
+
+        // The module was reloaded and the counters started over.
+        if (snaps[cur ^ 1].created != snaps[cur].created)
+            memcpy(&snaps[cur], &snaps[cur ^ 1], sizeof(Snapshot));
+
+        PrintRates(&snaps[cur ^ 1], &snaps[cur], interval);
+        cur ^= 1;
+
+        if (count > 0)
+            count--;
+    }
+
+    free(snaps);
+    munmap((void *)seg, sizeof(HSStatsSegment));
+
+    return 0;
+}
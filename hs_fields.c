@@ -6,6 +6,12 @@
 #include <stdio.h>
 #include <strings.h> // strcasecmp
 #include <ctype.h> // tolower
+#include <time.h> // clock_gettime
+#include <sys/stat.h>
+#include <sys/mman.h> // shm_open, mmap
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h> // offsetof
 
 #define MODULE_NAME "hs_fields"
 
@@ -20,6 +26,9 @@ local Imainloop *ml;
 local Iobjects *obj;
 local Ifake *fake;
 local Ihscoreitems *items;
+local Inet *net;
+local Igame *game;
+local Imapdata *mapdata;
 
 /*********************************/
 
@@ -28,6 +37,283 @@ typedef unsigned char u8;
 
 #define HSFIELD_NAME_SIZE 32
 
+#define HIST_BUCKETS HS_STATS_HIST_BUCKETS
+
+#define STAT_ADD(c, stat, n) __atomic_fetch_add(&(c)->stats[stat], (n), __ATOMIC_RELAXED)
+
+/**
+ * A copy of an arena's counters taken with CopyCounters.
+ */
+typedef struct HSFieldCounters {
+    /**
+     * One counter for each HSFieldStat.
+     */
+    uint64_t stats[StatCount];
+    
+    /**
+     * Log-linear histogram of class update times in nanoseconds. See HistBucket.
+     */
+    uint32_t updateNs[HIST_BUCKETS];
+    
+    /**
+     * Histogram of the time each tick spent on the arena's updates.
+     */
+    uint32_t tickNs[HIST_BUCKETS];
+    
+    /**
+     * Histogram of how many ticks late each update ran.
+     */
+    uint32_t lateTicks[HIST_BUCKETS];
+} HSFieldCounters;
+
+/**
+ * The kinds of work queued by field updates for the mainloop.
+ */
+enum HSFieldEffectType {
+    EffectSend = 0,
+    EffectPrize,
+    EffectDefer
+};
+
+/**
+ * A piece of work queued by a field update.
+ */
+typedef struct HSFieldEffect {
+    int type;
+    
+    /**
+     * The player the work is for. Unused for prizes, which keep their players in the queue's player array.
+     */
+    Player *p;
+    
+    union {
+        struct {
+            int len;
+            int flags;
+            byte data[HS_FIELD_MAX_PACKET];
+        } send;
+        
+        struct {
+            int first;
+            int count;
+            int prize;
+            int amount;
+        } prize;
+        
+        struct {
+            HSFieldDeferFunc func;
+            void *param;
+        } defer;
+    } u;
+} HSFieldEffect;
+
+/**
+ * Work queued by the field updates of one arena during a tick, applied in order on the mainloop.
+ */
+typedef struct HSFieldEffectQueue {
+    HSFieldEffect *effects;
+    int count;
+    int size;
+    
+    /**
+     * Players targeted by queued prizes.
+     */
+    Player **players;
+    int playerCount;
+    int playerSize;
+} HSFieldEffectQueue;
+
+/**
+ * The live players of one freq.
+ */
+typedef struct HSFreqMembers {
+    int freq;
+    LinkedList players;
+} HSFreqMembers;
+
+/**
+ * The number of ticks the arena's update load is tracked for. Must be a power of two.
+ */
+#define PHASE_SLOTS     128
+#define PHASE_MASK      (PHASE_SLOTS - 1)
+
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+
+/**
+ * Hierarchical timer wheel. Level 0 has a slot for each of the next 64 ticks, and each level above covers 64 times
+ * the span of the one below. Timers in the upper levels move down a level each time the level below wraps around.
+ * Inserting and cancelling are O(1), and a timer fires on its exact tick.
+ */
+typedef struct HSTimerWheel {
+    /**
+     * Circular lists with the slot itself as the head.
+     */
+    HSFieldTimer slots[WHEEL_LEVELS][WHEEL_SIZE];
+    
+    /**
+     * The last tick that was processed.
+     */
+    ticks_t now;
+    
+    /**
+     * The number of timers in the wheel.
+     */
+    int count;
+} HSTimerWheel;
+
+/**
+ * The number of field instances allocated at a time. Instances never move once allocated.
+ */
+#define STORE_CHUNK_BITS    6
+#define STORE_CHUNK_SIZE    (1 << STORE_CHUNK_BITS)
+
+/**
+ * A handle has the slot in its low bits and the slot's generation above them.
+ */
+#define HANDLE_SLOT_BITS    16
+#define HANDLE_SLOT_MASK    ((1 << HANDLE_SLOT_BITS) - 1)
+#define STORE_MAX_SLOTS     (1 << HANDLE_SLOT_BITS)
+
+/**
+ * The live field instances of an arena.
+ *
+ * What the engine reads for every instance is kept in dense arrays, one entry per live instance with no gaps,
+ * so sweeps over the arena only walk those. Ending an instance moves the last entry into its place.
+ * The rest of an instance is in its HSFieldInstance, which is allocated in chunks so it never moves,
+ * and found through the instance's slot.
+ *
+ * A slot's generation goes up each time its instance ends, so an old handle never finds the instance that reuses the slot.
+ */
+typedef struct HSFieldStore {
+    /**
+     * The number of live instances, and the room in the dense arrays.
+     */
+    int count;
+    int size;
+    
+    /**
+     * Dense arrays, indexed from 0 to count - 1.
+     */
+    int16_t *x;
+    int16_t *y;
+    int16_t *halfWidth;
+    int16_t *halfHeight;
+    int16_t *freq;
+    ticks_t *endTime;
+    ticks_t *nextUpdate;
+    uint16_t *typeIndex;
+    
+    /**
+     * The motion of the instance's type, where it was launched and when, and the last tick it moved.
+     */
+    uint8_t *motion;
+    int16_t *originX;
+    int16_t *originY;
+    ticks_t *startTime;
+    ticks_t *movedAt;
+    
+    /**
+     * The pid of the player that created the instance, or -1.
+     */
+    int *owner;
+    
+    /**
+     * The slot of the instance.
+     */
+    int *slot;
+    
+    /**
+     * The instances, STORE_CHUNK_SIZE to a chunk.
+     */
+    HSFieldInstance **chunks;
+    int chunkCount;
+    int chunksSize;
+    
+    /**
+     * Per slot: its generation, and the dense index of its instance or -1 while the slot is free.
+     */
+    uint16_t *generation;
+    int *dense;
+    
+    /**
+     * The slots free for reuse.
+     */
+    int *freeSlots;
+    int freeCount;
+    
+    /**
+     * The field types used by the instances, indexed by typeIndex, and how many instances use each.
+     * Entries no instance uses are NULL.
+     */
+    HSField **types;
+    int *typeRefs;
+    int typeCount;
+    int typesSize;
+} HSFieldStore;
+
+/**
+ * The most threads with their own epoch record. Readers on any further threads share a counter that holds off
+ * all reclamation while any of them is reading.
+ */
+#define EPOCH_MAX_THREADS   64
+
+/**
+ * Frees something that was retired. See EpochRetire.
+ */
+typedef void(*HSReclaimFunc)(void *ptr, void *context);
+
+/**
+ * Something unlinked that may still be seen by readers. Freed once every reader that was reading when it was retired has left.
+ */
+typedef struct HSRetired {
+    HSReclaimFunc func;
+    void *ptr;
+    void *context;
+    
+    /**
+     * The epoch it was retired in.
+     */
+    uint64_t epoch;
+} HSRetired;
+
+/**
+ * The epoch a thread entered its read section in, or 0 while it isn't reading. Only the owning thread writes it.
+ */
+typedef struct HSEpochRecord {
+    uint64_t epoch;
+    int depth;
+} HSEpochRecord;
+
+/**
+ * An instance due for an update this tick.
+ */
+typedef struct HSDueInstance {
+    /**
+     * When the update was due.
+     */
+    ticks_t deadline;
+    
+    /**
+     * The instance's id, to break deadline ties.
+     */
+    uint32_t id;
+    
+    /**
+     * The instance's index in the store.
+     */
+    int index;
+} HSDueInstance;
+
+/**
+ * The heatmaps count per cell of 2^HEAT_CELL_BITS pixels square, over the whole 16384 pixel map.
+ */
+#define HEAT_CELL_BITS      8
+#define HEAT_GRID           (16384 >> HEAT_CELL_BITS)
+#define HEAT_CELLS          (HEAT_GRID * HEAT_GRID)
+
 /**
  * Structure for the per-arena data.
  */
@@ -38,17 +324,132 @@ typedef struct HSFieldArenaData {
     LinkedList fields;
     
     /**
-     * The list of field instances currently alive in this arena.
+     * The field instances currently alive in this arena.
      */
-    LinkedList instances;
+    HSFieldStore store;
     
     /**
      * The radius for each ship.
      */
     int cfgShipRadius[8];
+    
+    /**
+     * Kill:EnterDelay, the ticks before a dead player respawns.
+     */
+    int cfgEnterDelay;
+    
+    /**
+     * Set while hs_fields is attached to the arena.
+     */
+    int attached;
+    
+    /**
+     * How far from a field's edge, in pixels, players are sent its LVZ.
+     */
+    int viewDistance;
+    
+    /**
+     * The fewest ticks between the LVZ moves sent to a player for moving fields.
+     */
+    int LVZMoveInterval;
+    
+    /**
+     * Set from attach until the field loader has published the arena's field types, and during ?reloadfields.
+     */
+    int fieldsLoading;
+    
+    /**
+     * The field counters for this arena. Points into the shared stats segment, or at localStats
+     * when the segment has no free arena slots. Updated with relaxed atomics from whichever thread does the work.
+     */
+    HSStatsArena *stats;
+    
+    /**
+     * Counters used when the arena has no slot in the stats segment.
+     */
+    HSStatsArena localStats;
+    
+    /**
+     * The counters as they were when the last metrics record was written.
+     */
+    HSFieldCounters lastMetrics;
+    
+    /**
+     * The players captured for the current tick. Read by the field updates.
+     */
+    HSFieldSnapshot snapshot;
+    int snapshotSize;
+    
+    /**
+     * The instances due for an update this tick.
+     */
+    HSDueInstance *due;
+    int dueCount;
+    int dueSize;
+    
+    /**
+     * The arena's share of the tick budget for this tick, in nanoseconds. 0 for no limit.
+     */
+    uint64_t budgetNs;
+    
+    /**
+     * The number of instances whose next update falls on each tick, indexed by the tick modulo PHASE_SLOTS.
+     * New instances start on the least loaded tick so updates don't bunch up on the same ticks.
+     */
+    int phaseLoad[PHASE_SLOTS];
+    
+    /**
+     * Ends instances when their duration runs out.
+     */
+    HSTimerWheel *wheel;
+    
+    /**
+     * Where field instances were launched, and where fields acted on players. Row major, updated with relaxed atomics.
+     */
+    uint32_t *heatLaunches;
+    uint32_t *heatHits;
+    
+    /**
+     * The wall masks of the arena's instances by HSFieldMaskEntry.key. Protected by pthread_mutex.
+     */
+    HashTable masks;
+    
+    /**
+     * The instances whose timers fired this tick.
+     */
+    HSFieldInstance **expired;
+    int expiredCount;
+    int expiredSize;
+    
+    /**
+     * Work queued by this tick's updates.
+     */
+    HSFieldEffectQueue effects;
+    
+    /**
+     * An HSFreqMembers for each freq with live players, kept up to date by the player callbacks.
+     * Spectators and dead players are left out, so the snapshot never has to skip them. Protected by pthread_mutex.
+     */
+    LinkedList freqLists;
+    
+    /**
+     * Scratch space used to order freqLists when building the snapshot.
+     */
+    HSFreqMembers **sortedFreqs;
+    int sortedFreqsSize;
+    int freqsSize;
 } HSFieldArenaData;
 local int adkey;
 
+/**
+ * Where a player is in launching a field.
+ */
+enum HSFieldOwnerState {
+    FieldNone = 0,
+    FieldPending,
+    FieldActive
+};
+
 /**
  * Structure for the per-player data
  */
@@ -58,13 +459,39 @@ typedef struct HSFieldPlayerData {
      */
     u8 dead     : 1;
     
+    /**
+     * Set while SendFieldMoves has sent the player LVZ moves this tick.
+     */
+    u8 movesSent : 1;
+    
     // padding
-    u8 buffer   : 7;
+    u8 buffer   : 6;
+
+    /**
+     * The last time the player was sent LVZ moves for moving fields.
+     */
+    ticks_t lastLVZMove;
 
     /**
      * The last time the player created a field instance.
      */
     ticks_t lastField;
+
+    /**
+     * One of HSFieldOwnerState. ?field claims it with a compare and swap, so a player never has more
+     * than one spawn request or instance at a time.
+     */
+    int fieldState;
+
+    /**
+     * Serial of the player's latest spawn request. Requests with an older serial are stale.
+     */
+    uint32_t spawnSerial;
+
+    /**
+     * The freq list the player is in, or NULL if they are spectating, dead or not in the arena.
+     */
+    HSFreqMembers *members;
 } HSFieldPlayerData;
 local int pdkey;
 
@@ -75,425 +502,4261 @@ local pthread_mutex_t pthread_mutex;
 
 local HashTable g_fieldClasses;
 
-/*******************************/
+/**
+ * A set of class properties. Sets whose class lists its keys are kept in g_sharedProperties
+ * and reused by every field type with the same class and key values.
+ */
+typedef struct HSFieldProperties {
+    /**
+     * The class name and the values of its keys, or NULL for a set that isn't shared.
+     */
+    char *key;
+    
+    /**
+     * Hex FNV-1a hash of key, the key in g_sharedProperties.
+     */
+    char fingerprint[20];
+    
+    HSFieldClass *fieldClass;
+    
+    /**
+     * The number of field types using the set.
+     */
+    int refs;
+    
+    HashTable table;
+} HSFieldProperties;
 
-// Field iterate functions
-typedef int(*HSFieldIterateFunc)(LinkedList *fields, HSField *field, const void *extra);
-local HSField *HSFieldIterate(LinkedList *fields, HSFieldIterateFunc func, const void *extra);
+#define PROPERTIES_SET(t) ((HSFieldProperties *)((char *)(t) - offsetof(HSFieldProperties, table)))
 
-local int GetFieldByName(LinkedList *fields, HSField *field, const void *name);
-local int GetFieldByPropertyValue(LinkedList *fields, HSField *field, const void *value);
-local int UpdateNextLVZId(LinkedList *fields, HSField *field, const void *array);
-local int UnloadFields(LinkedList *list, HSField *field, const void *arena);
-local int AddFieldClass(LinkedList *fields, HSField *field, const void *className);
-local int RemoveFieldClass(LinkedList *fields, HSField *field, const void *className);
-local int RemoveClassInstances(LinkedList *fields, HSField *field, const void *fClass);
+/**
+ * A section listed in the config during ?reloadfields, parsed before the live field types are touched.
+ */
+typedef struct HSReloadEntry {
+    /**
+     * The live field type for the section, or NULL if the section is new.
+     */
+    HSField *field;
+    
+    /**
+     * The freshly parsed type. Has properties only if the live type needs new ones.
+     * Becomes the live type when the section is new or changed class, and is freed otherwise.
+     */
+    HSField *parsed;
+    
+    /**
+     * Non-zero if the section changed class, so the live type is replaced instead of patched.
+     */
+    int replace;
+} HSReloadEntry;
 
+/**
+ * A wall mask and the instances using it. The bits follow the entry in the same allocation.
+ */
+typedef struct HSFieldMaskEntry {
+    /**
+     * The center tile and reach in tiles, the key in the arena's masks.
+     */
+    char key[32];
+    
+    /**
+     * The number of instances using the mask.
+     */
+    int refs;
+    
+    HSFieldMask mask;
+} HSFieldMaskEntry;
 
-// Field instance iterate functions
-typedef int(HSFieldInstanceFunc)(LinkedList *list, HSFieldInstance *instance, const void *extra);
-local HSFieldInstance *HSFieldInstanceIterate(LinkedList *, HSFieldInstanceFunc func, const void *extra);
+#define MASK_ENTRY(m) ((HSFieldMaskEntry *)((char *)(m) - offsetof(HSFieldMaskEntry, mask)))
 
-local int GetOneInstanceFromPlayer(LinkedList *, HSFieldInstance *, const void *player);
-local int RemoveAllInstancesFromPlayer(LinkedList *, HSFieldInstance *, const void *player);
-local int RemoveAllInstancesOfType(LinkedList *, HSFieldInstance *, const void *type);
+/**
+ * Map tiles are 16 pixels square, and the map is 1024 tiles on a side.
+ */
+#define TILE_BITS           4
+#define MAP_TILES           1024
 
-// Other functions
-local void BeginFieldInstance(Arena *arena, Player *p, HSField *type);
-local void EndFieldInstance(Arena *arena, HSFieldInstance *inst);
-local int HandleRespawn(void *_p);
-local int UpdateFieldInstance(void *param);
-local int LoadField(Arena *arena, char *cfgname);
-local int LoadFields(Arena *arena);
+/**
+ * Tiles 1 to 161 are walls. Doors open and close, so they never block a field.
+ */
+#define TILE_LAST_WALL      161
 
-// Callbacks
-local void OnShipFreqChange(Player *p, int newShip, int oldShip, int newFreq, int oldFreq);
-local void OnPlayerAction(Player *p, int action, Arena *arena);
-local void OnPlayerKill(Arena *arena, Player *killer, Player *killed, int bounty, int flags, int *pts, int *green);
+/**
+ * The shared property sets by fingerprint. Protected by pthread_mutex.
+ */
+local HashTable g_sharedProperties;
+
+/**
+ * The id given to the next field instance.
+ */
+local uint32_t g_nextInstanceId;
+
+/*******************************/
+
+#define TRACE_MAX_THREADS 32
+
+/**
+ * A single compact event in the tick trace.
+ */
+typedef struct HSTraceEvent {
+    /**
+     * The raw clock value when the event started.
+     */
+    uint64_t start;
+    
+    /**
+     * The raw clock ticks the event took. Zero for instant events.
+     */
+    uint32_t duration;
+    
+    /**
+     * The id of the field instance.
+     */
+    uint32_t instance;
+    
+    /**
+     * One of the HSTraceKind values.
+     */
+    uint16_t kind;
+    
+    /**
+     * Event specific argument, such as a target pid.
+     */
+    int16_t arg;
+    
+    /**
+     * Event specific value, such as bytes sent.
+     */
+    int32_t value;
+} HSTraceEvent;
+
+/**
+ * Per-thread ring of trace events. Only the owning thread writes to it, so recording needs no locks.
+ */
+typedef struct HSTraceRing {
+    /**
+     * The thread number shown in the trace.
+     */
+    int tid;
+    
+    /**
+     * Size of the events array minus one. The size is a power of two.
+     */
+    uint32_t mask;
+    
+    /**
+     * The total number of events written. Published with release ordering after each event.
+     */
+    uint64_t head;
+    
+    HSTraceEvent events[];
+} HSTraceRing;
+
+local volatile int g_tracing;
+local uint32_t g_traceRingSize;
+local uint64_t g_traceClockStart;
+local uint64_t g_traceNsStart;
+local char g_traceFile[256];
+
+/**
+ * Heatmaps are written to this prefix followed by the arena name and the kind of heatmap.
+ */
+local char g_heatmapPrefix[256];
+
+local __thread HSTraceRing *t_traceRing;
+local HSTraceRing *g_traceRings[TRACE_MAX_THREADS];
+local int g_traceRingCount;
+local pthread_mutex_t g_traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Epoch reclamation. Retiring something advances the global epoch, and it is freed once no reader has
+ * an epoch at or below the one it was retired in.
+ */
+local uint64_t g_epoch = 1;
+local HSEpochRecord g_epochRecords[EPOCH_MAX_THREADS];
+local int g_epochRecordCount;
+local int g_epochOverflow;
+local HSRetired *g_retired;
+local int g_retiredCount;
+local int g_retiredSize;
+local HSRetired *g_reclaiming;
+local int g_reclaimingSize;
+local pthread_mutex_t g_epochMutex = PTHREAD_MUTEX_INITIALIZER;
+
+local __thread HSEpochRecord *t_epochRecord;
+local __thread int t_epochNoRecord;
+local __thread int t_epochOverflowDepth;
+
+local const char *g_traceKindNames[TraceKindCount] = {
+    "begin", "update", "end", "fireweapon", "overrideresend"
+};
+
+#define METRICS_BUFFER_SIZE (256 * 1024)
+
+/**
+ * Double buffered writer for the metrics file.
+ * The mainloop formats records into the front buffer and hands it over when the writer thread has emptied the back buffer.
+ */
+typedef struct HSMetricsWriter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    
+    /**
+     * Buffer being filled by the mainloop. Only touched by the mainloop.
+     */
+    char *front;
+    int frontLen;
+    
+    /**
+     * Buffer being written by the writer thread. backLen is protected by lock.
+     */
+    char *back;
+    int backLen;
+    
+    /**
+     * Set to stop the writer thread once everything is written.
+     */
+    int quit;
+    
+    /**
+     * The amount of records dropped because the writer fell behind.
+     */
+    int dropped;
+    
+    /**
+     * Seconds between records. Zero when the metrics file is disabled.
+     */
+    int interval;
+    
+    char file[256];
+    long maxBytes;
+    int maxFiles;
+} HSMetricsWriter;
+
+local HSMetricsWriter g_metrics;
+
+/**
+ * Background thread that loads the field types of newly attached arenas, one arena at a time.
+ */
+typedef struct HSFieldTypeLoader {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    
+    /**
+     * Arenas waiting for their field types, in attach order.
+     */
+    LinkedList queue;
+    
+    /**
+     * The arena being loaded, or NULL.
+     */
+    Arena *current;
+    
+    /**
+     * Set to stop the loader thread.
+     */
+    int quit;
+    
+    /**
+     * Set while the thread runs. Arenas load on the mainloop when it couldn't be started.
+     */
+    int running;
+} HSFieldTypeLoader;
+
+local HSFieldTypeLoader g_loader;
+
+/**
+ * The stats segment. Shared memory when available, otherwise a private allocation with the same layout.
+ */
+local HSStatsSegment *g_stats;
+local int g_statsShared;
+local char g_statsShmName[64];
+local pthread_mutex_t g_statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Maps registered field classes to their slot in the stats segment.
+ */
+local HSFieldClass *g_statsClassKeys[HS_STATS_MAX_CLASSES];
+
+#define MAX_WORKER_THREADS 64
+
+typedef void(*HSWorkFunc)(void *job);
+
+/**
+ * A fixed set of threads that run a batch of jobs together with the calling thread.
+ */
+typedef struct HSWorkerPool {
+    pthread_t threads[MAX_WORKER_THREADS];
+    int threadCount;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    
+    /**
+     * The current batch. Only changed while no thread is working on a batch.
+     */
+    HSWorkFunc func;
+    void **jobs;
+    int jobCount;
+    
+    /**
+     * The next job to take. Taken with an atomic add.
+     */
+    int nextJob;
+    
+    /**
+     * Jobs finished in the current batch and threads inside any batch. Protected by lock.
+     */
+    int finished;
+    int active;
+    
+    /**
+     * Increased for every batch so sleeping workers know there is new work.
+     */
+    unsigned generation;
+    
+    /**
+     * Set while the current batch takes workers. Cleared when it finishes, so a worker that wakes late stays out.
+     */
+    int open;
+    
+    int quit;
+} HSWorkerPool;
+
+local HSWorkerPool g_pool;
+
+/**
+ * Set while an update batch runs without pthread_mutex. Changes to the instance store or the field types
+ * wait in EngineLock for it to clear, since the updates read both. Cleared under g_batchLock.
+ */
+local int g_batchRunning;
+local pthread_mutex_t g_batchLock = PTHREAD_MUTEX_INITIALIZER;
+local pthread_cond_t g_batchDone = PTHREAD_COND_INITIALIZER;
+
+/**
+ * The attached arenas, gathered at the start of each tick.
+ */
+local Arena **g_arenas;
+local int g_arenasSize;
+
+/**
+ * The arenas with instances to update this tick, in the order their queues are drained.
+ */
+local Arena **g_jobs;
+local int g_jobsSize;
+
+/**
+ * The arena whose instances the current thread is updating. Queued work is only used while this is set.
+ */
+local __thread Arena *t_updatingArena;
+
+/**
+ * A ?field request waiting for the engine tick.
+ */
+typedef struct HSSpawnRequest {
+    struct HSSpawnRequest *next;
+
+    /**
+     * The player is looked up again by pid when the request is handled, since they may be gone by then.
+     * The arena is only compared, never dereferenced.
+     */
+    Arena *arena;
+    int pid;
+    int ship;
+    uint32_t serial;
+
+    /**
+     * The player's field property sum when they used the command.
+     */
+    int fieldMask;
+
+    /**
+     * The requested field name, or empty to pick one the player owns.
+     */
+    char name[32];
+} HSSpawnRequest;
+
+/**
+ * Intrusive multi-producer single-consumer queue. Producers swap themselves into head,
+ * the engine tick pops from tail. The stub keeps the queue from ever being empty of nodes.
+ */
+typedef struct HSSpawnQueue {
+    HSSpawnRequest *head;
+    HSSpawnRequest *tail;
+    HSSpawnRequest stub;
+} HSSpawnQueue;
+
+local HSSpawnQueue g_spawnQueue;
+local uint32_t g_nextSpawnSerial;
+
+/**
+ * Ticks between checks for players moving into or out of view of field instances.
+ */
+local int g_viewInterval;
+
+/**
+ * hs_fields:TickBudgetUs in nanoseconds. The time all arenas together may spend on updates each tick,
+ * split between them by how many updates each has due. 0 for no limit.
+ */
+local uint64_t g_tickBudgetNs;
+
+/*******************************/
+
+// Field iterate functions
+typedef int(*HSFieldIterateFunc)(LinkedList *fields, HSField *field, const void *extra);
+local HSField *HSFieldIterate(LinkedList *fields, HSFieldIterateFunc func, const void *extra);
+
+local int GetFieldByName(LinkedList *fields, HSField *field, const void *name);
+local int GetFieldBySection(LinkedList *fields, HSField *field, const void *section);
+local int GetFieldByPropertyValue(LinkedList *fields, HSField *field, const void *value);
+local int UpdateNextLVZId(LinkedList *fields, HSField *field, const void *array);
+local int UnloadFields(LinkedList *list, HSField *field, const void *arena);
+local int AddFieldClass(LinkedList *fields, HSField *field, const void *className);
+local int RemoveFieldClass(LinkedList *fields, HSField *field, const void *className);
+local int RemoveClassInstances(LinkedList *fields, HSField *field, const void *fClass);
+
+
+// Field instance iterate functions
+typedef int(HSFieldInstanceFunc)(HSFieldStore *store, int index, const void *extra);
+local HSFieldInstance *HSFieldInstanceIterate(HSFieldStore *store, HSFieldInstanceFunc func, const void *extra);
+
+local int GetOneInstanceFromPlayer(HSFieldStore *store, int index, const void *player);
+local int RemoveAllInstancesFromPlayer(HSFieldStore *store, int index, const void *player);
+local int RemoveAllInstancesOfType(HSFieldStore *store, int index, const void *type);
+local int RemoveViewer(HSFieldStore *store, int index, const void *player);
+
+// Instance store
+local inline HSFieldInstance *StoreSlotInstance(HSFieldStore *store, int slot);
+local inline HSFieldInstance *StoreInstance(HSFieldStore *store, int index);
+local inline int StoreIndex(HSFieldStore *store, const HSFieldInstance *inst);
+local void StoreReserve(HSFieldStore *store, int count);
+local int StoreAddChunk(HSFieldStore *store);
+local int StoreTypeIndex(HSFieldStore *store, HSField *type);
+local HSFieldInstance *StoreAdd(HSFieldStore *store, const HSFieldInstance *src, ticks_t nextUpdate);
+local void StoreRemove(HSFieldStore *store, HSFieldInstance *inst);
+local void StoreRelease(HSFieldStore *store, HSFieldInstance *inst);
+local HSFieldInstance *StoreLookup(HSFieldStore *store, HSFieldHandle handle);
+local void StoreRefreshType(HSFieldStore *store, HSField *type);
+local void StoreFree(HSFieldStore *store);
+
+// Epoch reclamation
+local void EpochEnter();
+local void EpochExit();
+local void EpochRetire(HSReclaimFunc func, void *ptr, void *context);
+local int EpochReclaim();
+local void EpochDrain(Arena *arena, HSFieldClass *fieldClass);
+local void EpochReclaimAll();
+local void ReclaimFree(void *ptr, void *context);
+local void DestroyInstance(HSFieldInstance *inst);
+local void ReclaimSlot(void *ptr, void *context);
+local void ReclaimSlotRelease(void *ptr, void *context);
+local void ReclaimStore(void *ptr, void *context);
+local int RetireMask(const char *key, void *val, void *clos);
+local void ReclaimField(void *ptr, void *context);
+local void ReclaimProperties(void *ptr, void *context);
+local void *StoreCopyArray(void *array, int count, int size, size_t elementSize);
+
+// Trace functions
+local uint64_t TraceNow();
+local uint64_t MonotonicNs();
+local HSTraceRing *TraceRegisterThread();
+local void TraceRecord(HSFieldInstance *inst, int kind, uint64_t start, uint64_t end, int arg, int value);
+local int TraceDump(const char *filename);
+
+// Stats functions
+local int HistBucket(uint64_t ns);
+local uint64_t HistBucketValue(int bucket);
+local uint64_t HistPercentile(const uint32_t *hist, int permille);
+local void CopyCounters(HSFieldCounters *dest, HSStatsArena *src);
+local void AddStat(Arena *arena, int stat, int amount);
+local void StatsOpenSegment();
+local void StatsCloseSegment();
+local void StatsAttachArena(Arena *arena);
+local void StatsDetachArena(Arena *arena);
+local void StatsBindClass(const char *className, HSFieldClass *fieldClass);
+local void StatsUnbindClass(HSFieldClass *fieldClass);
+local HSStatsClass *StatsGetClass(HSFieldClass *fieldClass);
+local int MetricsTimer(void *unused);
+local void *MetricsThread(void *unused);
+
+// Heatmaps
+local inline void HeatAdd(uint32_t *grid, int x, int y);
+local int HeatmapDump(const uint32_t *grid, const char *filename);
+
+// Other functions
+local int BeginFieldInstance(Arena *arena, Player *p, HSField *type);
+local void MoveFieldLVZ(HSFieldInstance *inst, Target *target);
+local void ShowFieldLVZ(HSFieldInstance *inst, Target *target);
+local void HideFieldLVZ(HSFieldInstance *inst, Target *target);
+local int InViewRange(HSFieldArenaData *adata, int x, int y, int halfWidth, int halfHeight, Player *p);
+local int IsViewer(const HSFieldInstance *inst, Player *p);
+local void ViewerAdd(HSFieldInstance *inst, Player *p);
+local void ViewerRemove(HSFieldInstance *inst, Player *p);
+local void UpdateViewers(Arena *arena, int index);
+local int VisibilityTimer(void *unused);
+local void EndFieldInstance(Arena *arena, HSFieldInstance *inst);
+local int HandleRespawn(void *_p);
+local void UpdateFieldInstance(HSFieldInstance *inst);
+local void *GrowArray(void *array, int *size, int needed, size_t elementSize);
+local int CompareDeadlines(const void *a, const void *b);
+local int CollectDueInstances(HSFieldArenaData *adata, ticks_t now);
+local void ReserveSnapshot(HSFieldArenaData *adata, int count);
+local void BuildSnapshot(Arena *arena, HSFieldArenaData *adata, ticks_t now);
+local void ExpireInstances(Arena *arena, HSFieldArenaData *adata, ticks_t now);
+local void MoveInstances(HSFieldArenaData *adata, ticks_t now);
+local void SendFieldMoves(HSFieldArenaData *adata, ticks_t now);
+local void PhaseAdd(HSFieldArenaData *adata, ticks_t tick, int amount);
+local ticks_t PickFirstUpdate(HSFieldArenaData *adata, ticks_t now, int delay);
+local ticks_t NextUpdate(ticks_t last, int delay, ticks_t now);
+local void RunArenaJob(void *job);
+local void FinishArenaJob(Arena *arena);
+local int FieldEngineTick(void *unused);
+local void HandleSpawnRequest(HSSpawnRequest *req);
+local void DrainSpawnRequests();
+local void ParseField(Arena *arena, const char *cfgname, HSField *field);
+local HSField *LoadField(Arena *arena, char *cfgname, LinkedList *fields);
+local int LoadFields(Arena *arena, LinkedList *fields);
+local void BuildArenaFields(Arena *arena);
+local int PatchField(Arena *arena, HSField *field, HSField *parsed);
+local int PropertiesChanged(Arena *arena, HSField *field);
+local void ReloadFields(Arena *arena, int *added, int *changed, int *removed);
+
+// Field loader
+local void LoaderStart();
+local void LoaderStop();
+local void LoaderQueue(Arena *arena);
+local void LoaderCancel(Arena *arena);
+local void LoaderWaitIdle();
+local void *LoaderMain(void *unused);
+
+// Shared properties
+local int PropertiesKey(Arena *arena, const char *section, HSFieldClass *fieldClass, const char *className, char *key, int size);
+local HSFieldProperties *FindProperties(const char *fingerprint, HSFieldClass *fieldClass, const char *key);
+local HashTable *AcquireProperties(Arena *arena, const char *section, HSFieldClass *fieldClass, const char *className);
+local void ReleaseProperties(Arena *arena, HSFieldClass *fieldClass, HashTable *properties);
+
+// Shapes
+local int SinQ10(int degrees);
+local int ContainsSquare(const HSFieldInstance *inst, int shipRadius, int dx, int dy);
+local int ContainsCircle(const HSFieldInstance *inst, int shipRadius, int dx, int dy);
+local int ContainsRect(const HSFieldInstance *inst, int shipRadius, int dx, int dy);
+local int ContainsRing(const HSFieldInstance *inst, int shipRadius, int dx, int dy);
+local int ContainsCone(const HSFieldInstance *inst, int shipRadius, int dx, int dy);
+local void LoadShape(Arena *arena, const char *section, HSField *field);
+local void LoadMotion(Arena *arena, const char *section, HSField *field);
+
+// Wall masks
+local HSFieldMaskEntry *MaskBuild(Arena *arena, int cx, int cy, int rx, int ry);
+local const HSFieldMask *AcquireMask(Arena *arena, HSField *type, int x, int y);
+local void ReleaseMask(Arena *arena, const HSFieldMask *mask);
+
+// Timer wheel
+local void WheelInit(HSTimerWheel *wheel, ticks_t now);
+local void WheelAdd(HSTimerWheel *wheel, HSFieldTimer *timer);
+local void WheelCancel(HSTimerWheel *wheel, HSFieldTimer *timer);
+local void WheelAdvance(HSTimerWheel *wheel, ticks_t to, LinkedList *fired);
+
+// Worker pool functions
+local int WorkerPoolStart(HSWorkerPool *pool, int threadCount);
+local void WorkerPoolStop(HSWorkerPool *pool);
+local void WorkerPoolRun(HSWorkerPool *pool, HSWorkFunc func, void **jobs, int jobCount);
+local void *WorkerPoolMain(void *param);
+local void EngineLock();
+
+// Spawn queue
+local void SpawnQueueInit(HSSpawnQueue *queue);
+local void SpawnQueuePush(HSSpawnQueue *queue, HSSpawnRequest *req);
+local HSSpawnRequest *SpawnQueuePop(HSSpawnQueue *queue);
+local void CancelSpawnRequest(Player *p);
+
+// Callbacks
+local void OnShipFreqChange(Player *p, int newShip, int oldShip, int newFreq, int oldFreq);
+local void OnPlayerAction(Player *p, int action, Arena *arena);
+local void OnPlayerKill(Arena *arena, Player *killer, Player *killed, int bounty, int flags, int *pts, int *green);
+local void OnArenaAction(Arena *arena, int action);
+local void OnPlayerSpawn(Player *p, int reason);
+local void LoadArenaConfig(Arena *arena);
+
+// Freq lists
+local void FreqListAdd(Arena *arena, Player *p);
+local void FreqListRemove(Arena *arena, Player *p);
+local void FreqListsInit(Arena *arena);
+local void FreqListsClear(Arena *arena);
+
+// Interface functions
+local int RegisterFieldClass(const char *className, HSFieldClass *fieldClass);
+local void UnregisterFieldClass(const char *className);
+local void TraceEvent(HSFieldInstance *inst, int kind, int arg, int value);
+local const HSFieldSnapshot *GetSnapshot(Arena *arena);
+local HSFieldInstance *GetInstance(Arena *arena, HSFieldHandle handle);
+local void BeginRead();
+local void EndRead();
+local void RecordHit(HSFieldInstance *inst, int x, int y);
+local void QueueSendToOne(HSFieldInstance *inst, Player *p, byte *data, int len, int flags);
+local void QueueGivePrize(HSFieldInstance *inst, const Target *target, int prize, int count);
+local void QueueDefer(HSFieldInstance *inst, HSFieldDeferFunc func, Player *p, void *param);
+
+/********************************/
+
+/**
+ * Call func on each field type until one of the func calls returns non-zero.
+ */
+local HSField *HSFieldIterate(LinkedList *list, HSFieldIterateFunc func, const void *extra) {
+    HSField *result = NULL, *data = NULL;
+    Link *link;
+
+    // func may end instances, which has to wait out a running batch before taking the mutex
+    EngineLock();
+    FOR_EACH(list, data, link) {
+        int found = func(list, data, extra);
+        if (found) {
+            result = data;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pthread_mutex);
+    return result;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Returns the field that matches name.
+ */
+local int GetFieldByName(LinkedList *fields, HSField *field, const void *name) {
+    return strcasecmp(field->name, (char *)name) == 0;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Returns the field loaded from a config section.
+ */
+local int GetFieldBySection(LinkedList *fields, HSField *field, const void *section) {
+    return strcasecmp(field->section, (char *)section) == 0;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Returns the field that matches the property value.
+ */
+local int GetFieldByPropertyValue(LinkedList *fields, HSField *field, const void *value) {
+    int *pVal = (int *)value;
+    return field->property == *pVal;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Cycles through the object IDs for the field corners.
+ */
+local int UpdateNextLVZId(LinkedList *fields, HSField *field, const void *array) {
+    int *LVZId = (int *)array;
+    
+    for (int i = 0; i < 4; i++) {
+        if (field->LVZIdBase[i] != LVZId[i])
+            continue;
+        field->nextLVZId[i]++;
+        if (field->nextLVZId[i] >= field->LVZIdBase[i] + field->maxLVZIds)
+            field->nextLVZId[i] = field->LVZIdBase[i];
+    }
+    return 0;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Frees up the memory used by each field type once no reader can still see it.
+ */
+local int UnloadFields(LinkedList *list, HSField *field, const void *arena) {
+    EpochRetire(ReclaimField, field, (void *)arena);
+    return 0;
+}
+
+/** 
+ * A function to be used with HSFieldIterate. Adds the field class to the fields with that className.
+ */
+local int AddFieldClass(LinkedList *fields, HSField *field, const void *className) {
+    if (strcasecmp(field->className, (char *)className) == 0) {
+        HSFieldClass *fClass = HashGetOne(&g_fieldClasses, (char *)className);
+        field->fieldClass = fClass;
+    }
+    return 0;
+}
+
+/** 
+ * A function to be used with HSFieldIterate. Removes the field class from the fields with that className.
+ */
+local int RemoveFieldClass(LinkedList *fields, HSField *field, const void *className) {
+    if (strcasecmp(field->className, (char *)className) == 0)
+        field->fieldClass = NULL;
+    return 0;
+}
+
+/**
+ * A function to be used with HSFieldIterate. Removes all field instances that have a type with a specific class.
+ */
+local int RemoveClassInstances(LinkedList *fields, HSField *field, const void *fClass) {
+    if (field->fieldClass == fClass) {
+        HSFieldArenaData *adata = P_ARENA_DATA(field->arena, adkey);
+        HSFieldInstanceIterate(&adata->store, RemoveAllInstancesOfType, field);
+    }
+    return 0;
+}
+
+/********************************/
+
+/**
+ * Call func on each field instance until one of the func calls returns non-zero.
+ * Goes from the end of the store, so func may end the instance it is given.
+ */
+local HSFieldInstance *HSFieldInstanceIterate(HSFieldStore *store, HSFieldInstanceFunc func, const void *extra) {
+    HSFieldInstance *result = NULL;
+
+    EngineLock();
+    for (int i = store->count - 1; i >= 0; i--) {
+        int found = func(store, i, extra);
+        if (found) {
+            result = StoreInstance(store, i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pthread_mutex);
+    return result;
+}
+
+/**
+ * A function to be used with HSFieldInstanceIterate. Returns a field instance that the specific player created.
+ */
+local int GetOneInstanceFromPlayer(HSFieldStore *store, int index, const void *player) {
+    return store->owner[index] == ((Player *)player)->pid;
+}
+
+/**
+ * A function to be used with HSFieldInstanceIterate. Removes all of the field instances created by a specific player.
+ */
+local int RemoveAllInstancesFromPlayer(HSFieldStore *store, int index, const void *player) {
+    if (player && store->owner[index] != ((Player *)player)->pid)
+        return 0;
+
+    HSFieldInstance *instance = StoreInstance(store, index);
+    EndFieldInstance(instance->arena, instance);
+    return 0;
+}
+
+/**
+ * A function to be used with HSFieldInstanceIterate. Removes all of the field instances of a specific type.
+ */
+local int RemoveAllInstancesOfType(HSFieldStore *store, int index, const void *type) {
+    if (store->types[store->typeIndex[index]] == type) {
+        HSFieldInstance *instance = StoreInstance(store, index);
+        EndFieldInstance(instance->arena, instance);
+    }
+    return 0;
+}
+
+/**
+ * Used with HSFieldInstanceIterate to forget a player that is leaving the arena.
+ */
+local int RemoveViewer(HSFieldStore *store, int index, const void *player) {
+    ViewerRemove(StoreInstance(store, index), (Player *)player);
+    return 0;
+}
+
+/********************************/
+
+/**
+ * Starts a read section on the calling thread. Anything retired after this stays allocated until the matching EpochExit.
+ * Sections nest, and never block once the thread has a record.
+ */
+local void EpochEnter() {
+    HSEpochRecord *record = t_epochRecord;
+
+    if (!record && !t_epochNoRecord) {
+        pthread_mutex_lock(&g_epochMutex);
+        if (g_epochRecordCount < EPOCH_MAX_THREADS)
+            record = t_epochRecord = &g_epochRecords[g_epochRecordCount++];
+        pthread_mutex_unlock(&g_epochMutex);
+
+        t_epochNoRecord = !record;
+    }
+
+    if (!record) {
+        if (t_epochOverflowDepth++ == 0) {
+            __atomic_fetch_add(&g_epochOverflow, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+        return;
+    }
+
+    // The store has to be visible to EpochReclaim before this thread reads anything it protects
+    if (record->depth++ == 0) {
+        __atomic_store_n(&record->epoch, __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * Ends a read section on the calling thread.
+ */
+local void EpochExit() {
+    HSEpochRecord *record = t_epochRecord;
+
+    if (!record) {
+        if (--t_epochOverflowDepth == 0)
+            __atomic_fetch_sub(&g_epochOverflow, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+
+    if (--record->depth == 0)
+        __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Frees ptr with func once every read section that might still see it has ended.
+ * ptr must already be unlinked from everything readers can reach.
+ */
+local void EpochRetire(HSReclaimFunc func, void *ptr, void *context) {
+    pthread_mutex_lock(&g_epochMutex);
+
+    g_retired = GrowArray(g_retired, &g_retiredSize, g_retiredCount + 1, sizeof(HSRetired));
+
+    HSRetired *retired = &g_retired[g_retiredCount++];
+    retired->func = func;
+    retired->ptr = ptr;
+    retired->context = context;
+    retired->epoch = __atomic_fetch_add(&g_epoch, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&g_epochMutex);
+}
+
+/**
+ * Frees everything retired before the oldest read section began. Returns the number of retired things left waiting.
+ */
+local int EpochReclaim() {
+    int count = 0, left = 0;
+
+    pthread_mutex_lock(&g_epochMutex);
+
+    if (!g_retiredCount || __atomic_load_n(&g_epochOverflow, __ATOMIC_SEQ_CST)) {
+        left = g_retiredCount;
+        pthread_mutex_unlock(&g_epochMutex);
+        return left;
+    }
+
+    uint64_t oldest = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < g_epochRecordCount; i++) {
+        uint64_t epoch = __atomic_load_n(&g_epochRecords[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+
+    // Take the ready ones out, keeping the order of the rest
+    g_reclaiming = GrowArray(g_reclaiming, &g_reclaimingSize, g_retiredCount, sizeof(HSRetired));
+    for (int i = 0; i < g_retiredCount; i++) {
+        if (g_retired[i].epoch < oldest)
+            g_reclaiming[count++] = g_retired[i];
+        else
+            g_retired[left++] = g_retired[i];
+    }
+    g_retiredCount = left;
+
+    // Reclaim functions may retire more, but only the mainloop reclaims, so g_reclaiming is safe to use unlocked
+    pthread_mutex_unlock(&g_epochMutex);
+
+    for (int i = 0; i < count; i++)
+        g_reclaiming[i].func(g_reclaiming[i].ptr, g_reclaiming[i].context);
+
+    return left;
+}
+
+/**
+ * Runs the class code waiting in retired entries of an arena or a class that is going away, since it can't be
+ * called later. That is the destructors of the arena's or the class's instances, and the class's property cleanups.
+ * Readers only use the engine's parts of those, so the memory is still left for EpochReclaim. A class's slots go
+ * back to their store then. An arena's entries are dropped, since its whole store is retired with it.
+ * Entries of anything else are left alone. Only called from the mainloop, like EpochReclaim.
+ */
+local void EpochDrain(Arena *arena, HSFieldClass *fieldClass) {
+    int count = 0, left = 0;
+
+    pthread_mutex_lock(&g_epochMutex);
+
+    g_reclaiming = GrowArray(g_reclaiming, &g_reclaimingSize, g_retiredCount, sizeof(HSRetired));
+    for (int i = 0; i < g_retiredCount; i++) {
+        HSRetired retired = g_retired[i];
+
+        if (retired.func == ReclaimSlot) {
+            HSFieldInstance *inst = (HSFieldInstance *)retired.ptr;
+
+            if (inst->arena == arena) {
+                g_reclaiming[count++] = retired;
+                continue;
+            }
+            if (fieldClass && inst->type && inst->type->fieldClass == fieldClass) {
+                g_reclaiming[count++] = retired;
+                retired.func = ReclaimSlotRelease;
+            }
+        } else if (retired.func == ReclaimProperties) {
+            if (fieldClass && ((HSFieldProperties *)retired.ptr)->fieldClass == fieldClass)
+                g_reclaiming[count++] = retired;
+        }
+
+        g_retired[left++] = retired;
+    }
+    g_retiredCount = left;
+
+    // The class code may retire more, which only appends to g_retired
+    pthread_mutex_unlock(&g_epochMutex);
+
+    for (int i = 0; i < count; i++) {
+        if (g_reclaiming[i].func == ReclaimSlot) {
+            DestroyInstance((HSFieldInstance *)g_reclaiming[i].ptr);
+        } else {
+            HSFieldProperties *set = (HSFieldProperties *)g_reclaiming[i].ptr;
+
+            // Cleared so ReclaimProperties only frees the set
+            if (set->fieldClass->cleanup)
+                set->fieldClass->cleanup((Arena *)g_reclaiming[i].context, &set->table);
+            set->fieldClass = NULL;
+        }
+    }
+}
+
+/**
+ * Frees everything retired without waiting for readers. Only for module unload, once the workers are stopped and
+ * nothing else holds the interface, so nobody can be reading.
+ */
+local void EpochReclaimAll() {
+    int count;
+
+    // Reclaim functions may retire more, so keep going until nothing is left
+    while (1) {
+        pthread_mutex_lock(&g_epochMutex);
+        count = g_retiredCount;
+        g_reclaiming = GrowArray(g_reclaiming, &g_reclaimingSize, count, sizeof(HSRetired));
+        memcpy(g_reclaiming, g_retired, count * sizeof(HSRetired));
+        g_retiredCount = 0;
+        pthread_mutex_unlock(&g_epochMutex);
+
+        if (!count)
+            break;
+
+        for (int i = 0; i < count; i++)
+            g_reclaiming[i].func(g_reclaiming[i].ptr, g_reclaiming[i].context);
+    }
+}
+
+/**
+ * Reclaim function for plain allocations.
+ */
+local void ReclaimFree(void *ptr, void *context) {
+    afree(ptr);
+}
+
+/**
+ * Calls the class destructor of an ended instance.
+ */
+local void DestroyInstance(HSFieldInstance *inst) {
+    if (inst->type && inst->type->fieldClass && inst->type->fieldClass->destructor)
+        inst->type->fieldClass->destructor(inst);
+}
+
+/**
+ * Reclaim function for ended instances. Runs the class destructor, then gives the slot back to its store.
+ */
+local void ReclaimSlot(void *ptr, void *context) {
+    DestroyInstance((HSFieldInstance *)ptr);
+    ReclaimSlotRelease(ptr, context);
+}
+
+/**
+ * Reclaim function for ended instances whose destructor already ran. Gives the slot back to its store.
+ */
+local void ReclaimSlotRelease(void *ptr, void *context) {
+    HSFieldInstance *inst = (HSFieldInstance *)ptr;
+
+    EngineLock();
+    ReleaseMask(inst->arena, inst->mask);
+    StoreRelease((HSFieldStore *)context, inst);
+    pthread_mutex_unlock(&pthread_mutex);
+}
+
+/**
+ * Reclaim function for unloaded field types.
+ */
+local void ReclaimField(void *ptr, void *context) {
+    HSField *field = (HSField *)ptr;
+
+    ReleaseProperties((Arena *)context, field->fieldClass, field->properties);
+    afree(field);
+}
+
+/**
+ * Reclaim function for property sets no field type uses anymore. Calls the class cleanup.
+ */
+local void ReclaimProperties(void *ptr, void *context) {
+    HSFieldProperties *set = (HSFieldProperties *)ptr;
+
+    if (set->fieldClass && set->fieldClass->cleanup)
+        set->fieldClass->cleanup((Arena *)context, &set->table);
+    HashDeinit(&set->table);
+    afree(set->key);
+    afree(set);
+}
+
+/**
+ * Reclaim function for the instance store of a detached arena.
+ */
+local void ReclaimStore(void *ptr, void *context) {
+    StoreFree((HSFieldStore *)ptr);
+    afree(ptr);
+}
+
+/**
+ * HashEnum callback that retires the wall masks left in a detached arena.
+ */
+local int RetireMask(const char *key, void *val, void *clos) {
+    EpochRetire(ReclaimFree, val, NULL);
+    return 1;
+}
+
+/**
+ * Returns a copy of the first count elements of array with room for size, and retires the old array.
+ */
+local void *StoreCopyArray(void *array, int count, int size, size_t elementSize) {
+    void *copy = amalloc(size * elementSize);
+
+    if (array) {
+        memcpy(copy, array, count * elementSize);
+        EpochRetire(ReclaimFree, array, NULL);
+    }
+
+    return copy;
+}
+
+/********************************/
+
+/**
+ * Returns the instance in a slot.
+ */
+local inline HSFieldInstance *StoreSlotInstance(HSFieldStore *store, int slot) {
+    return &store->chunks[slot >> STORE_CHUNK_BITS][slot & (STORE_CHUNK_SIZE - 1)];
+}
+
+/**
+ * Returns the instance at a dense index.
+ */
+local inline HSFieldInstance *StoreInstance(HSFieldStore *store, int index) {
+    return StoreSlotInstance(store, store->slot[index]);
+}
+
+/**
+ * Returns the dense index of an instance, or -1 if it was removed.
+ */
+local inline int StoreIndex(HSFieldStore *store, const HSFieldInstance *inst) {
+    return store->dense[inst->handle & HANDLE_SLOT_MASK];
+}
+
+/**
+ * Makes sure the dense arrays have room for count instances.
+ */
+local void StoreReserve(HSFieldStore *store, int count) {
+    int size;
+
+    if (count <= store->size)
+        return;
+
+#define GROW_COLUMN(column) \
+    size = store->size; \
+    store->column = GrowArray(store->column, &size, count, sizeof(*store->column))
+
+    GROW_COLUMN(x);
+    GROW_COLUMN(y);
+    GROW_COLUMN(halfWidth);
+    GROW_COLUMN(halfHeight);
+    GROW_COLUMN(freq);
+    GROW_COLUMN(endTime);
+    GROW_COLUMN(nextUpdate);
+    GROW_COLUMN(typeIndex);
+    GROW_COLUMN(motion);
+    GROW_COLUMN(originX);
+    GROW_COLUMN(originY);
+    GROW_COLUMN(startTime);
+    GROW_COLUMN(movedAt);
+    GROW_COLUMN(owner);
+    GROW_COLUMN(slot);
+
+#undef GROW_COLUMN
+
+    store->size = size;
+}
+
+/**
+ * Allocates another chunk of instances and frees its slots. Returns 0 if the store has no more slots to give.
+ */
+local int StoreAddChunk(HSFieldStore *store) {
+    int first = store->chunkCount * STORE_CHUNK_SIZE;
+    int slots = first + STORE_CHUNK_SIZE;
+
+    if (slots > STORE_MAX_SLOTS)
+        return 0;
+
+    // StoreLookup reads these without the mutex, so they are copied and the old ones retired instead of reallocated.
+    // The new arrays are filled in before they are published, and chunkCount is published last.
+    if (store->chunkCount == store->chunksSize) {
+        int size = store->chunksSize ? store->chunksSize * 2 : 4;
+
+        __atomic_store_n(&store->chunks, StoreCopyArray(store->chunks, store->chunkCount, size, sizeof(HSFieldInstance *)),
+            __ATOMIC_RELEASE);
+        store->chunksSize = size;
+    }
+    store->chunks[store->chunkCount] = amalloc(STORE_CHUNK_SIZE * sizeof(HSFieldInstance));
+
+    uint16_t *generation = StoreCopyArray(store->generation, first, slots, sizeof(*generation));
+    int *dense = StoreCopyArray(store->dense, first, slots, sizeof(*dense));
+
+    store->freeSlots = arealloc(store->freeSlots, slots * sizeof(*store->freeSlots));
+
+    // Pushed in reverse so the lowest slot is handed out first
+    for (int i = slots - 1; i >= first; i--) {
+        generation[i] = 1;
+        dense[i] = -1;
+        store->freeSlots[store->freeCount++] = i;
+    }
+
+    __atomic_store_n(&store->generation, generation, __ATOMIC_RELEASE);
+    __atomic_store_n(&store->dense, dense, __ATOMIC_RELEASE);
+    __atomic_store_n(&store->chunkCount, store->chunkCount + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/**
+ * Returns the index of a field type in the store's type table, adding it if no instance uses it yet.
+ * Counts one more instance using it.
+ */
+local int StoreTypeIndex(HSFieldStore *store, HSField *type) {
+    int index = -1;
+
+    for (int i = 0; i < store->typeCount; i++) {
+        if (store->types[i] == type) {
+            index = i;
+            break;
+        }
+        if (!store->types[i] && index == -1)
+            index = i;
+    }
+
+    if (index == -1) {
+        int size = store->typesSize;
+
+        store->types = GrowArray(store->types, &size, store->typeCount + 1, sizeof(HSField *));
+        store->typeRefs = GrowArray(store->typeRefs, &store->typesSize, store->typeCount + 1, sizeof(int));
+        index = store->typeCount++;
+        store->types[index] = NULL;
+        store->typeRefs[index] = 0;
+    }
+
+    store->types[index] = type;
+    store->typeRefs[index]++;
+
+    return index;
+}
+
+/**
+ * Copies a new instance into a free slot and adds its dense entry. Returns the stored instance,
+ * or NULL if the store is full.
+ */
+local HSFieldInstance *StoreAdd(HSFieldStore *store, const HSFieldInstance *src, ticks_t nextUpdate) {
+    if (!store->freeCount && !StoreAddChunk(store))
+        return NULL;
+
+    StoreReserve(store, store->count + 1);
+
+    int slot = store->freeSlots[--store->freeCount];
+    int i = store->count++;
+    HSFieldInstance *inst = StoreSlotInstance(store, slot);
+
+    *inst = *src;
+    inst->handle = ((HSFieldHandle)store->generation[slot] << HANDLE_SLOT_BITS) | slot;
+
+    store->x[i] = src->x;
+    store->y[i] = src->y;
+    store->halfWidth[i] = src->type->halfWidth;
+    store->halfHeight[i] = src->type->halfHeight;
+    store->freq[i] = src->freq;
+    store->endTime[i] = src->endTime;
+    store->nextUpdate[i] = nextUpdate;
+    store->typeIndex[i] = StoreTypeIndex(store, src->type);
+    store->motion[i] = src->type->motion;
+    store->originX[i] = src->x;
+    store->originY[i] = src->y;
+    store->startTime[i] = src->endTime - src->type->duration;
+    store->movedAt[i] = store->startTime[i];
+    store->owner[i] = src->player ? src->player->pid : -1;
+    store->slot[i] = slot;
+    // Publishes the copied instance to StoreLookup
+    __atomic_store_n(&store->dense[slot], i, __ATOMIC_RELEASE);
+
+    return inst;
+}
+
+/**
+ * Removes an instance's dense entry and makes its handle stale. The instance itself stays valid
+ * until StoreRelease, so its destructor can still use it.
+ */
+local void StoreRemove(HSFieldStore *store, HSFieldInstance *inst) {
+    int slot = inst->handle & HANDLE_SLOT_MASK;
+    int i = store->dense[slot];
+
+    if (i < 0)
+        return;
+
+    int type = store->typeIndex[i];
+    if (!--store->typeRefs[type])
+        store->types[type] = NULL;
+
+    // Fill the gap with the last entry
+    int last = --store->count;
+    if (i != last) {
+#define MOVE_COLUMN(column) store->column[i] = store->column[last]
+
+        MOVE_COLUMN(x);
+        MOVE_COLUMN(y);
+        MOVE_COLUMN(halfWidth);
+        MOVE_COLUMN(halfHeight);
+        MOVE_COLUMN(freq);
+        MOVE_COLUMN(endTime);
+        MOVE_COLUMN(nextUpdate);
+        MOVE_COLUMN(typeIndex);
+        MOVE_COLUMN(motion);
+        MOVE_COLUMN(originX);
+        MOVE_COLUMN(originY);
+        MOVE_COLUMN(startTime);
+        MOVE_COLUMN(movedAt);
+        MOVE_COLUMN(owner);
+        MOVE_COLUMN(slot);
+
+#undef MOVE_COLUMN
+
+        __atomic_store_n(&store->dense[store->slot[i]], i, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&store->dense[slot], -1, __ATOMIC_RELEASE);
+    __atomic_store_n(&store->generation[slot], store->generation[slot] == 0xFFFF ? 1 : store->generation[slot] + 1,
+        __ATOMIC_RELAXED);
+}
+
+/**
+ * Gives a removed instance's slot back for reuse. Only called through ReclaimSlot, so no reader still has the instance.
+ */
+local void StoreRelease(HSFieldStore *store, HSFieldInstance *inst) {
+    store->freeSlots[store->freeCount++] = inst->handle & HANDLE_SLOT_MASK;
+}
+
+/**
+ * Returns the instance a handle names, or NULL if the instance was removed.
+ * Doesn't need the mutex. Without it, the caller must be in a read section and may get an instance that is ending.
+ */
+local HSFieldInstance *StoreLookup(HSFieldStore *store, HSFieldHandle handle) {
+    int slot = handle & HANDLE_SLOT_MASK;
+
+    // chunkCount is published after the arrays, so arrays loaded after it cover at least that many slots
+    if (slot >= __atomic_load_n(&store->chunkCount, __ATOMIC_ACQUIRE) * STORE_CHUNK_SIZE)
+        return NULL;
+
+    uint16_t *generation = __atomic_load_n(&store->generation, __ATOMIC_ACQUIRE);
+    int *dense = __atomic_load_n(&store->dense, __ATOMIC_ACQUIRE);
+    HSFieldInstance **chunks = __atomic_load_n(&store->chunks, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&dense[slot], __ATOMIC_ACQUIRE) < 0)
+        return NULL;
+    if (__atomic_load_n(&generation[slot], __ATOMIC_RELAXED) != handle >> HANDLE_SLOT_BITS)
+        return NULL;
+
+    return &chunks[slot >> STORE_CHUNK_BITS][slot & (STORE_CHUNK_SIZE - 1)];
+}
+
+/**
+ * Copies the size and motion of a field type into the entries of its instances, after the type was patched.
+ */
+local void StoreRefreshType(HSFieldStore *store, HSField *type) {
+    EngineLock();
+    for (int i = 0; i < store->count; i++) {
+        if (store->types[store->typeIndex[i]] != type)
+            continue;
+
+        store->halfWidth[i] = type->halfWidth;
+        store->halfHeight[i] = type->halfHeight;
+        store->motion[i] = type->motion;
+    }
+    pthread_mutex_unlock(&pthread_mutex);
+}
+
+/**
+ * Frees everything in the store. All of its instances must have ended.
+ */
+local void StoreFree(HSFieldStore *store) {
+    for (int i = 0; i < store->chunkCount; i++)
+        afree(store->chunks[i]);
+
+    afree(store->chunks);
+    afree(store->generation);
+    afree(store->dense);
+    afree(store->freeSlots);
+    afree(store->types);
+    afree(store->typeRefs);
+    afree(store->x);
+    afree(store->y);
+    afree(store->halfWidth);
+    afree(store->halfHeight);
+    afree(store->freq);
+    afree(store->endTime);
+    afree(store->nextUpdate);
+    afree(store->typeIndex);
+    afree(store->motion);
+    afree(store->originX);
+    afree(store->originY);
+    afree(store->startTime);
+    afree(store->movedAt);
+    afree(store->owner);
+    afree(store->slot);
+
+    memset(store, 0, sizeof(*store));
+}
+
+/********************************/
+
+/**
+ * Checks if a ship is in a square.
+ */
+int InSquare(Arena *arena, int ship, int sx, int sy, int r, int x, int y) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    
+    if (ship < SHIP_WARBIRD || ship > SHIP_SHARK)
+        return 0;
+
+    int R = adata->cfgShipRadius[ship];
+
+    if ((x + R) < (sx - r))
+        return 0;
+    if ((x - R) > (sx + r))
+        return 0;
+    if ((y + R) < (sy - r))
+        return 0;
+    if ((y - R) > (sy + r))
+        return 0;
+
+    return 1;
+}
+
+/**
+ * Checks if a ship touches a field instance, using the shape of the instance's field type.
+ */
+int InField(const HSFieldInstance *inst, int ship, int x, int y) {
+    HSFieldArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+
+    if (ship < SHIP_WARBIRD || ship > SHIP_SHARK)
+        return 0;
+
+    if (!inst->type->contains(inst, adata->cfgShipRadius[ship], x - inst->x, y - inst->y))
+        return 0;
+
+    return !inst->mask || HS_IN_MASK(inst->mask, x, y);
+}
+
+/**
+ * Sine of an angle in degrees, scaled by 1024. Interpolates a table with an entry every 9 degrees,
+ * which is also the step between ship rotations.
+ */
+local int SinQ10(int degrees) {
+    static const short table[11] = { 0, 160, 316, 465, 602, 724, 828, 912, 974, 1011, 1024 };
+    int sign = 1;
+
+    degrees %= 360;
+    if (degrees < 0)
+        degrees += 360;
+
+    if (degrees >= 180) {
+        degrees -= 180;
+        sign = -1;
+    }
+    if (degrees > 90)
+        degrees = 180 - degrees;
+
+    int i = degrees / 9, rem = degrees % 9;
+    int value = table[i];
+
+    if (rem)
+        value += (table[i + 1] - table[i]) * rem / 9;
+
+    return sign * value;
+}
+
+/**
+ * The ship's box overlaps the field's square.
+ */
+local int ContainsSquare(const HSFieldInstance *inst, int shipRadius, int dx, int dy) {
+    int r = inst->type->radius + shipRadius;
+
+    return dx >= -r && dx <= r && dy >= -r && dy <= r;
+}
+
+/**
+ * The ship's circle overlaps the field's circle.
+ */
+local int ContainsCircle(const HSFieldInstance *inst, int shipRadius, int dx, int dy) {
+    int r = inst->type->radius + shipRadius;
+
+    return dx * dx + dy * dy <= r * r;
+}
+
+/**
+ * The ship's box overlaps the field's rectangle.
+ */
+local int ContainsRect(const HSFieldInstance *inst, int shipRadius, int dx, int dy) {
+    int w = inst->type->halfWidth + shipRadius;
+    int h = inst->type->halfHeight + shipRadius;
+
+    return dx >= -w && dx <= w && dy >= -h && dy <= h;
+}
+
+/**
+ * The ship's circle overlaps the ring, not just the hole in the middle.
+ */
+local int ContainsRing(const HSFieldInstance *inst, int shipRadius, int dx, int dy) {
+    int outer = inst->type->radius + shipRadius;
+    int inner = inst->type->innerRadius - shipRadius;
+    int distSq = dx * dx + dy * dy;
+
+    if (distSq > outer * outer)
+        return 0;
+
+    return inner <= 0 || distSq >= inner * inner;
+}
+
+/**
+ * The ship's center is within radius plus the ship radius of the field, and inside the cone's angle.
+ * The angle test compares squares so no square root is needed: dot >= |d| * cos(half angle).
+ */
+local int ContainsCone(const HSFieldInstance *inst, int shipRadius, int dx, int dy) {
+    int r = inst->type->radius + shipRadius;
+    int64_t distSq = (int64_t)dx * dx + (int64_t)dy * dy;
+
+    if (distSq > (int64_t)r * r)
+        return 0;
+
+    int64_t dot = (int64_t)dx * inst->dirX + (int64_t)dy * inst->dirY;
+    int64_t cos = inst->type->coneCos;
+
+    if (cos >= 0) {
+        if (dot < 0)
+            return 0;
+        return dot * dot >= distSq * cos * cos;
+    }
+
+    // Cones wider than 180 degrees only leave out a narrow cone behind them
+    if (dot >= 0)
+        return 1;
+    return dot * dot <= distSq * cos * cos;
+}
+
+/**
+ * Reads the shape of a field type and picks its containment test.
+ */
+local void LoadShape(Arena *arena, const char *section, HSField *field) {
+    const char *shape = cfg->GetStr(arena->cfg, section, "shape");
+
+    field->halfWidth = field->halfHeight = field->radius;
+
+    if (!shape || !*shape || !strcasecmp(shape, "square")) {
+        field->shape = ShapeSquare;
+        field->contains = ContainsSquare;
+    } else if (!strcasecmp(shape, "circle")) {
+        field->shape = ShapeCircle;
+        field->contains = ContainsCircle;
+    } else if (!strcasecmp(shape, "rect")) {
+        field->shape = ShapeRect;
+        field->contains = ContainsRect;
+        field->halfWidth = cfg->GetInt(arena->cfg, section, "halfwidth", field->radius);
+        field->halfHeight = cfg->GetInt(arena->cfg, section, "halfheight", field->radius);
+    } else if (!strcasecmp(shape, "ring")) {
+        field->shape = ShapeRing;
+        field->contains = ContainsRing;
+        field->innerRadius = cfg->GetInt(arena->cfg, section, "innerradius", field->radius / 2);
+    } else if (!strcasecmp(shape, "cone")) {
+        // The cone's bounding box is the circle it is cut from, since it can point any way
+        int angle = cfg->GetInt(arena->cfg, section, "coneangle", 90);
+
+        if (angle < 1)
+            angle = 1;
+        if (angle > 359)
+            angle = 359;
+
+        field->shape = ShapeCone;
+        field->contains = ContainsCone;
+        field->coneCos = SinQ10(90 - angle / 2);
+    } else {
+        lm->LogA(L_WARN, MODULE_NAME, arena, "%s has unknown shape %s, using square.", section, shape);
+        field->shape = ShapeSquare;
+        field->contains = ContainsSquare;
+    }
+}
+
+/**
+ * Reads how the field moves once launched from the "motion" key.
+ */
+local void LoadMotion(Arena *arena, const char *section, HSField *field) {
+    const char *motion = cfg->GetStr(arena->cfg, section, "motion");
+
+    if (!motion || !*motion || !strcasecmp(motion, "fixed")) {
+        field->motion = MotionFixed;
+    } else if (!strcasecmp(motion, "follow")) {
+        field->motion = MotionFollow;
+    } else if (!strcasecmp(motion, "drift")) {
+        field->motion = MotionDrift;
+        field->velocityX = cfg->GetInt(arena->cfg, section, "velocityx", 0);
+        field->velocityY = cfg->GetInt(arena->cfg, section, "velocityy", 0);
+    } else {
+        lm->LogA(L_WARN, MODULE_NAME, arena, "%s has unknown motion %s, using fixed.", section, motion);
+        field->motion = MotionFixed;
+    }
+}
+
+/*******************************/
+
+/**
+ * Builds the mask of the tiles within rx, ry of tile cx, cy that can see it.
+ * A tile sees the center if the line between the two tiles' centers crosses no wall.
+ */
+local HSFieldMaskEntry *MaskBuild(Arena *arena, int cx, int cy, int rx, int ry) {
+    int left = cx - rx < 0 ? 0 : cx - rx;
+    int top = cy - ry < 0 ? 0 : cy - ry;
+    int right = cx + rx >= MAP_TILES ? MAP_TILES - 1 : cx + rx;
+    int bottom = cy + ry >= MAP_TILES ? MAP_TILES - 1 : cy + ry;
+    int width = right - left + 1, height = bottom - top + 1;
+    int words = (width * height + 31) >> 5;
+    HSFieldMaskEntry *entry = amalloc(sizeof(HSFieldMaskEntry) + words * sizeof(uint32_t));
+    char *walls = amalloc(width * height);
+
+    entry->mask.left = left;
+    entry->mask.top = top;
+    entry->mask.width = width;
+    entry->mask.height = height;
+    entry->mask.bits = (uint32_t *)(entry + 1);
+
+    // Read each tile once, the line walks below look at the same tiles many times
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int tile = mapdata->GetTile(arena, left + x, top + y);
+            walls[y * width + x] = tile > 0 && tile <= TILE_LAST_WALL;
+        }
+    }
+
+    int ox = cx - left, oy = cy - top;
+
+    for (int ty = 0; ty < height; ty++) {
+        for (int tx = 0; tx < width; tx++) {
+            int dx = tx - ox, dy = ty - oy;
+            int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+            int visible = 1;
+
+            // Only the tiles between the two ends can block, a ship is never centered in a wall
+            for (int s = 1; s < steps && visible; s++) {
+                int x = ox + (2 * dx * s + (dx < 0 ? -steps : steps)) / (2 * steps);
+                int y = oy + (2 * dy * s + (dy < 0 ? -steps : steps)) / (2 * steps);
+
+                visible = !walls[y * width + x];
+            }
+
+            if (visible) {
+                int n = ty * width + tx;
+                entry->mask.bits[n >> 5] |= 1u << (n & 31);
+            }
+        }
+    }
+
+    afree(walls);
+
+    return entry;
+}
+
+/**
+ * Returns the wall mask for an instance of a field type launched at x, y. Reuses the mask of another instance
+ * launched from the same tile, otherwise builds one.
+ */
+local const HSFieldMask *AcquireMask(Arena *arena, HSField *type, int x, int y) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldMaskEntry *entry;
+    char key[32];
+    int shipRadius = 0;
+
+    for (int i = 0; i < 8; i++) {
+        if (adata->cfgShipRadius[i] > shipRadius)
+            shipRadius = adata->cfgShipRadius[i];
+    }
+
+    // Cover every tile a ship touching the field can be centered on, measured from the center tile
+    int cx = x >> TILE_BITS, cy = y >> TILE_BITS;
+    int rx = ((type->halfWidth + shipRadius) >> TILE_BITS) + 1;
+    int ry = ((type->halfHeight + shipRadius) >> TILE_BITS) + 1;
+
+    snprintf(key, sizeof(key), "%d,%d,%d,%d", cx, cy, rx, ry);
+
+    pthread_mutex_lock(&pthread_mutex);
+    entry = HashGetOne(&adata->masks, key);
+    if (entry)
+        entry->refs++;
+    pthread_mutex_unlock(&pthread_mutex);
+
+    if (entry) {
+        STAT_ADD(adata->stats, StatMaskShares, 1);
+        return &entry->mask;
+    }
+
+    // Masks are only built by spawns, which all run on the mainloop, so nothing can add the key while this is unlocked
+    uint64_t start = MonotonicNs();
+    entry = MaskBuild(arena, cx, cy, rx, ry);
+    STAT_ADD(adata->stats, StatMaskBuildNs, MonotonicNs() - start);
+    STAT_ADD(adata->stats, StatMaskBuilds, 1);
+
+    astrncpy(entry->key, key, sizeof(entry->key));
+    entry->refs = 1;
+
+    pthread_mutex_lock(&pthread_mutex);
+    HashAdd(&adata->masks, entry->key, entry);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    return &entry->mask;
+}
+
+/**
+ * Drops an instance's hold on its wall mask, freeing it when no instance uses it anymore.
+ */
+local void ReleaseMask(Arena *arena, const HSFieldMask *mask) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldMaskEntry *entry;
+    int last;
+
+    if (!mask)
+        return;
+
+    entry = MASK_ENTRY(mask);
+
+    pthread_mutex_lock(&pthread_mutex);
+    last = --entry->refs == 0;
+    if (last)
+        HashRemove(&adata->masks, entry->key, entry);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    if (last)
+        afree(entry);
+}
+
+/*******************************/
+
+/**
+ * Returns the raw trace clock. Uses the cycle counter where available since it only costs a few nanoseconds.
+ */
+local inline uint64_t TraceNow() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return MonotonicNs();
+#endif
+}
+
+/**
+ * Returns the monotonic clock in nanoseconds. Used to convert the raw trace clock when dumping.
+ */
+local uint64_t MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Allocates the trace ring for the calling thread and adds it to the list of rings to dump.
+ */
+local HSTraceRing *TraceRegisterThread() {
+    HSTraceRing *ring = NULL;
+
+    pthread_mutex_lock(&g_traceMutex);
+    if (g_traceRingCount < TRACE_MAX_THREADS) {
+        ring = amalloc(sizeof(HSTraceRing) + g_traceRingSize * sizeof(HSTraceEvent));
+        ring->tid = g_traceRingCount + 1;
+        ring->mask = g_traceRingSize - 1;
+        g_traceRings[g_traceRingCount++] = ring;
+    }
+    pthread_mutex_unlock(&g_traceMutex);
+
+    t_traceRing = ring;
+    return ring;
+}
+
+/**
+ * Writes an event into the calling thread's ring. Callers check g_tracing first.
+ */
+local void TraceRecord(HSFieldInstance *inst, int kind, uint64_t start, uint64_t end, int arg, int value) {
+    HSTraceRing *ring = t_traceRing;
+
+    if (!ring && !(ring = TraceRegisterThread()))
+        return;
+
+    uint64_t head = ring->head;
+    HSTraceEvent *ev = &ring->events[head & ring->mask];
+
+    ev->start = start;
+    ev->duration = (uint32_t)(end - start);
+    ev->instance = inst ? inst->id : 0;
+    ev->kind = kind;
+    ev->arg = arg;
+    ev->value = value;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Interface function for recording instant events from field classes.
+ */
+local void TraceEvent(HSFieldInstance *inst, int kind, int arg, int value) {
+    if (!g_tracing || kind < 0 || kind >= TraceKindCount)
+        return;
+
+    uint64_t now = TraceNow();
+    TraceRecord(inst, kind, now, now, arg, value);
+}
+
+/**
+ * Writes every trace ring to a file in the Chrome trace event format.
+ * Rings keep being written while this runs, so events that may have been overwritten during the copy are skipped.
+ */
+local int TraceDump(const char *filename) {
+    FILE *f = fopen(filename, "w");
+    int written = 0;
+
+    if (!f)
+        return -1;
+
+    uint64_t clockNow = TraceNow();
+    uint64_t nsNow = MonotonicNs();
+    double usPerClock = 0.001;
+
+    if (clockNow > g_traceClockStart)
+        usPerClock = (double)(nsNow - g_traceNsStart) / (double)(clockNow - g_traceClockStart) / 1000.0;
+
+    fputs("{\"traceEvents\":[", f);
+
+    pthread_mutex_lock(&g_traceMutex);
+    for (int r = 0; r < g_traceRingCount; r++) {
+        HSTraceRing *ring = g_traceRings[r];
+        uint32_t size = ring->mask + 1;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t copied = head > size ? head - size : 0;
+        uint64_t first = copied;
+        HSTraceEvent *copy = amalloc(size * sizeof(HSTraceEvent));
+
+        for (uint64_t i = copied; i < head; i++)
+            copy[i - copied] = ring->events[i & ring->mask];
+
+        // The writer may have lapped the copy, anything it could have touched is unreliable.
+        uint64_t after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (after >= size && after - size + 1 > first)
+            first = after - size + 1;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"hs_fields thread %d\"}}",
+            written++ ? "," : "", ring->tid, ring->tid);
+
+        for (uint64_t i = first; i < head; i++) {
+            HSTraceEvent *ev = &copy[i - copied];
+            double ts = (double)(int64_t)(ev->start - g_traceClockStart) * usPerClock;
+
+            if (ev->kind >= TraceKindCount)
+                continue;
+
+            if (ev->kind <= TraceEnd) {
+                fprintf(f, ",{\"name\":\"%s\",\"cat\":\"hs_fields\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"instance\":%u}}",
+                    g_traceKindNames[ev->kind], ts, ev->duration * usPerClock, ring->tid, ev->instance);
+            } else {
+                fprintf(f, ",{\"name\":\"%s\",\"cat\":\"hs_fields\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"instance\":%u,\"target\":%d,\"value\":%d}}",
+                    g_traceKindNames[ev->kind], ts, ring->tid, ev->instance, ev->arg, ev->value);
+            }
+            written++;
+        }
+
+        afree(copy);
+    }
+    pthread_mutex_unlock(&g_traceMutex);
+
+    fputs("]}\n", f);
+    fclose(f);
+
+    return written;
+}
+
+/*******************************/
+
+/**
+ * Returns the histogram bucket for a duration. Each power of two is split into four buckets.
+ */
+local int HistBucket(uint64_t ns) {
+    if (ns < 4)
+        return (int)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = ((msb - 1) << 2) + (int)((ns >> (msb - 2)) & 3);
+
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+/**
+ * Returns the upper bound of a histogram bucket.
+ */
+local uint64_t HistBucketValue(int bucket) {
+    if (bucket < 4)
+        return bucket;
+
+    int msb = (bucket >> 2) + 1;
+    return ((uint64_t)(4 | (bucket & 3)) + 1) << (msb - 2);
+}
+
+/**
+ * Returns the value at the given permille of the histogram.
+ */
+local uint64_t HistPercentile(const uint32_t *hist, int permille) {
+    uint64_t total = 0, seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += hist[i];
+
+    if (!total)
+        return 0;
+
+    uint64_t target = (total * permille + 999) / 1000;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= target)
+            return HistBucketValue(i);
+    }
+
+    return HistBucketValue(HIST_BUCKETS - 1);
+}
+
+/**
+ * Copies counters that may be updated concurrently.
+ */
+local void CopyCounters(HSFieldCounters *dest, HSStatsArena *src) {
+    for (int i = 0; i < StatCount; i++)
+        dest->stats[i] = __atomic_load_n(&src->stats[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dest->updateNs[i] = __atomic_load_n(&src->updateNs[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dest->tickNs[i] = __atomic_load_n(&src->tickNs[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dest->lateTicks[i] = __atomic_load_n(&src->lateTicks[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * Interface function for field classes to add to an arena counter.
+ */
+local void AddStat(Arena *arena, int stat, int amount) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+
+    if (stat < 0 || stat >= StatCount)
+        return;
+
+    STAT_ADD(adata->stats, stat, amount);
+}
+
+/**
+ * Opens and maps the shared stats segment. Falls back to a private allocation so the counters always have a home.
+ */
+local void StatsOpenSegment() {
+    const char *name = cfg->GetStr(GLOBAL, "hs_fields", "StatsShm");
+    int fd = -1;
+
+    astrncpy(g_statsShmName, name ? name : HS_STATS_SHM_NAME, sizeof(g_statsShmName));
+
+    if (*g_statsShmName)
+        fd = shm_open(g_statsShmName, O_CREAT | O_RDWR, 0644);
+
+    if (fd != -1) {
+        if (ftruncate(fd, sizeof(HSStatsSegment)) == 0) {
+            void *mem = mmap(NULL, sizeof(HSStatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem != MAP_FAILED) {
+                g_stats = mem;
+                g_statsShared = 1;
+            }
+        }
+        close(fd);
+    }
+
+    if (!g_statsShared) {
+        if (*g_statsShmName)
+            lm->Log(L_WARN, "<%s> Unable to create stats segment %s, counters will be private.", MODULE_NAME, g_statsShmName);
+        g_stats = amalloc(sizeof(HSStatsSegment));
+    }
+
+    // The magic goes in last so readers never see a half initialized segment as valid.
+    __atomic_store_n(&g_stats->magic, 0, __ATOMIC_RELEASE);
+    memset((char *)g_stats + sizeof(g_stats->magic), 0, sizeof(HSStatsSegment) - sizeof(g_stats->magic));
+    g_stats->version = HS_STATS_VERSION;
+    g_stats->size = sizeof(HSStatsSegment);
+    g_stats->created = (uint64_t)time(NULL);
+    __atomic_store_n(&g_stats->magic, HS_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unmaps and removes the stats segment.
+ */
+local void StatsCloseSegment() {
+    if (!g_stats)
+        return;
+
+    if (g_statsShared) {
+        __atomic_store_n(&g_stats->magic, 0, __ATOMIC_RELEASE);
+        munmap(g_stats, sizeof(HSStatsSegment));
+        shm_unlink(g_statsShmName);
+    } else {
+        afree(g_stats);
+    }
+
+    g_stats = NULL;
+    g_statsShared = 0;
+}
+
+/**
+ * Starts a seqlock write section. Writers are serialized by g_statsMutex.
+ */
+local inline void StatsWriteBegin(uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Ends a seqlock write section.
+ */
+local inline void StatsWriteEnd(uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gives the arena a slot in the stats segment.
+ */
+local void StatsAttachArena(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSStatsArena *slot = NULL;
+
+    pthread_mutex_lock(&g_statsMutex);
+    for (int i = 0; i < HS_STATS_MAX_ARENAS; i++) {
+        if (!g_stats->arenas[i].inUse) {
+            slot = &g_stats->arenas[i];
+            break;
+        }
+    }
+
+    if (slot) {
+        StatsWriteBegin(&slot->seq);
+        astrncpy(slot->name, arena->name, sizeof(slot->name));
+        slot->live = 0;
+        slot->fakes = 0;
+        memset(slot->stats, 0, sizeof(slot->stats));
+        memset(slot->updateNs, 0, sizeof(slot->updateNs));
+        memset(slot->tickNs, 0, sizeof(slot->tickNs));
+        memset(slot->lateTicks, 0, sizeof(slot->lateTicks));
+        slot->backlog = 0;
+        slot->inUse = 1;
+        StatsWriteEnd(&slot->seq);
+    } else {
+        lm->LogA(L_WARN, MODULE_NAME, arena, "No free stats segment slot, counters will be private.");
+        memset(&adata->localStats, 0, sizeof(adata->localStats));
+        astrncpy(adata->localStats.name, arena->name, sizeof(adata->localStats.name));
+        slot = &adata->localStats;
+    }
+    pthread_mutex_unlock(&g_statsMutex);
+
+    adata->stats = slot;
+}
+
+/**
+ * Frees the arena's slot in the stats segment.
+ */
+local void StatsDetachArena(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSStatsArena *slot = adata->stats;
+
+    adata->stats = &adata->localStats;
+
+    if (!slot || slot == &adata->localStats)
+        return;
+
+    pthread_mutex_lock(&g_statsMutex);
+    StatsWriteBegin(&slot->seq);
+    slot->inUse = 0;
+    StatsWriteEnd(&slot->seq);
+    pthread_mutex_unlock(&g_statsMutex);
+}
+
+/**
+ * Gives a field class a slot in the stats segment. A class registered again under the same name keeps its counters.
+ */
+local void StatsBindClass(const char *className, HSFieldClass *fieldClass) {
+    int free = -1;
+
+    pthread_mutex_lock(&g_statsMutex);
+    for (int i = 0; i < HS_STATS_MAX_CLASSES; i++) {
+        HSStatsClass *slot = &g_stats->classes[i];
+
+        if (slot->inUse && strcasecmp(slot->name, className) == 0) {
+            free = i;
+            break;
+        }
+        if (!slot->inUse && free == -1)
+            free = i;
+    }
+
+    if (free != -1) {
+        HSStatsClass *slot = &g_stats->classes[free];
+
+        if (!slot->inUse) {
+            StatsWriteBegin(&g_stats->seq);
+            astrncpy(slot->name, className, sizeof(slot->name));
+            slot->inUse = 1;
+            StatsWriteEnd(&g_stats->seq);
+        }
+
+        g_statsClassKeys[free] = fieldClass;
+    }
+    pthread_mutex_unlock(&g_statsMutex);
+}
+
+/**
+ * Stops counting updates for a field class.
+ */
+local void StatsUnbindClass(HSFieldClass *fieldClass) {
+    pthread_mutex_lock(&g_statsMutex);
+    for (int i = 0; i < HS_STATS_MAX_CLASSES; i++) {
+        if (g_statsClassKeys[i] == fieldClass)
+            g_statsClassKeys[i] = NULL;
+    }
+    pthread_mutex_unlock(&g_statsMutex);
+}
+
+/**
+ * Returns the stats slot for a field class. A short pointer scan, cheap enough for every update.
+ */
+local HSStatsClass *StatsGetClass(HSFieldClass *fieldClass) {
+    for (int i = 0; i < HS_STATS_MAX_CLASSES; i++) {
+        if (g_statsClassKeys[i] == fieldClass)
+            return &g_stats->classes[i];
+    }
+    return NULL;
+}
+
+/**
+ * Timer that formats a metrics record for every arena and hands the buffer to the writer thread.
+ * Never touches the disk.
+ */
+local int MetricsTimer(void *unused) {
+    HSFieldArenaData *adata;
+    HSFieldCounters now;
+    uint32_t hist[HIST_BUCKETS];
+    uint32_t tickHist[HIST_BUCKETS];
+    uint32_t lateHist[HIST_BUCKETS];
+    Arena *arena;
+    Link *link;
+    long stamp = (long)time(NULL);
+
+    aman->Lock();
+    FOR_EACH_ARENA_P(arena, adata, adkey) {
+        if (!adata->attached)
+            continue;
+
+        int live = __atomic_load_n(&adata->stats->live, __ATOMIC_RELAXED);
+
+        CopyCounters(&now, adata->stats);
+
+        uint64_t delta[StatCount];
+        for (int i = 0; i < StatCount; i++)
+            delta[i] = now.stats[i] - adata->lastMetrics.stats[i];
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            hist[i] = now.updateNs[i] - adata->lastMetrics.updateNs[i];
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            tickHist[i] = now.tickNs[i] - adata->lastMetrics.tickNs[i];
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            lateHist[i] = now.lateTicks[i] - adata->lastMetrics.lateTicks[i];
+
+        adata->lastMetrics = now;
+
+        char line[512];
+        int len = snprintf(line, sizeof(line), "%ld,%s,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%d,%llu,%llu,%llu,%d,%llu,%llu,%llu,%llu,%llu\n",
+            stamp, arena->name, live,
+            (unsigned long long)delta[StatSpawns], (unsigned long long)delta[StatExpiries],
+            (unsigned long long)delta[StatUpdates],
+            (unsigned long long)HistPercentile(hist, 500), (unsigned long long)HistPercentile(hist, 900),
+            (unsigned long long)HistPercentile(hist, 990),
+            (unsigned long long)delta[StatWeaponPackets], (unsigned long long)delta[StatWeaponBytes],
+            (unsigned long long)delta[StatOverrideResends], (unsigned long long)delta[StatPrizeGrants],
+            __atomic_load_n(&adata->stats->fakes, __ATOMIC_RELAXED), (unsigned long long)delta[StatSuppressedShots],
+            (unsigned long long)HistPercentile(tickHist, 990), (unsigned long long)delta[StatDeferredUpdates],
+            __atomic_load_n(&adata->stats->backlog, __ATOMIC_RELAXED), (unsigned long long)HistPercentile(lateHist, 990),
+            (unsigned long long)delta[StatLVZMoves], (unsigned long long)delta[StatMaskBuilds],
+            (unsigned long long)delta[StatMaskShares], (unsigned long long)delta[StatMaskBuildNs]);
+
+        if (len <= 0 || len >= (int)sizeof(line) || g_metrics.frontLen + len > METRICS_BUFFER_SIZE) {
+            g_metrics.dropped++;
+            continue;
+        }
+
+        memcpy(g_metrics.front + g_metrics.frontLen, line, len);
+        g_metrics.frontLen += len;
+    }
+    aman->Unlock();
+
+    // Hand the buffer over if the writer is idle, otherwise keep filling it until the next interval.
+    pthread_mutex_lock(&g_metrics.lock);
+    if (!g_metrics.backLen && g_metrics.frontLen) {
+        char *temp = g_metrics.back;
+
+        g_metrics.back = g_metrics.front;
+        g_metrics.backLen = g_metrics.frontLen;
+        g_metrics.front = temp;
+        g_metrics.frontLen = 0;
+
+        pthread_cond_signal(&g_metrics.cond);
+    }
+    pthread_mutex_unlock(&g_metrics.lock);
+
+    return 1;
+}
+
+/**
+ * Opens the metrics file for appending. Writes the header if the file is new.
+ */
+local FILE *MetricsOpen(long *size) {
+    FILE *f = fopen(g_metrics.file, "a");
+
+    if (!f) {
+        lm->Log(L_WARN, "<%s> Unable to open metrics file %s.", MODULE_NAME, g_metrics.file);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+
+    if (*size <= 0) {
+        *size = fprintf(f, "time,arena,live,spawns,expiries,updates,update_p50_ns,update_p90_ns,update_p99_ns,"
+            "weapon_packets,weapon_bytes,override_resends,prize_grants,fakes,suppressed_shots,tick_p99_ns,deferred_updates,"
+            "backlog,late_p99_ticks,lvz_moves,mask_builds,mask_shares,mask_build_ns\n");
+    }
+
+    return f;
+}
+
+/**
+ * Shifts the metrics file to file.1, file.1 to file.2 and so on, dropping the oldest.
+ */
+local void MetricsRotate() {
+    char from[300], to[300];
+
+    for (int i = g_metrics.maxFiles - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", g_metrics.file, i);
+        snprintf(to, sizeof(to), "%s.%d", g_metrics.file, i + 1);
+        rename(from, to);
+    }
+
+    snprintf(to, sizeof(to), "%s.1", g_metrics.file);
+    if (g_metrics.maxFiles > 0)
+        rename(g_metrics.file, to);
+    else
+        remove(g_metrics.file);
+}
+
+/**
+ * Writer thread for the metrics file. Waits for the mainloop to hand over a buffer and writes it out.
+ */
+local void *MetricsThread(void *unused) {
+    FILE *f = NULL;
+    long size = 0;
+
+    pthread_mutex_lock(&g_metrics.lock);
+    while (1) {
+        while (!g_metrics.backLen && !g_metrics.quit)
+            pthread_cond_wait(&g_metrics.cond, &g_metrics.lock);
+
+        if (!g_metrics.backLen) {
+            // The timer is stopped before quit is set, so the front buffer is ours now.
+            if (!g_metrics.frontLen)
+                break;
+
+            char *temp = g_metrics.back;
+            g_metrics.back = g_metrics.front;
+            g_metrics.backLen = g_metrics.frontLen;
+            g_metrics.front = temp;
+            g_metrics.frontLen = 0;
+        }
+
+        int len = g_metrics.backLen;
+        pthread_mutex_unlock(&g_metrics.lock);
+
+        if (f && size + len > g_metrics.maxBytes) {
+            fclose(f);
+            f = NULL;
+            MetricsRotate();
+        }
+
+        if (!f)
+            f = MetricsOpen(&size);
+
+        if (f) {
+            fwrite(g_metrics.back, 1, len, f);
+            fflush(f);
+            size += len;
+        }
+
+        pthread_mutex_lock(&g_metrics.lock);
+        g_metrics.backLen = 0;
+    }
+    pthread_mutex_unlock(&g_metrics.lock);
+
+    if (f)
+        fclose(f);
+
+    return NULL;
+}
+
+/*******************************/
+
+/**
+ * Reads the common settings of a field type from its config section and looks up its class.
+ * Leaves the class properties alone.
+ */
+local void ParseField(Arena *arena, const char *cfgname, HSField *field) {
+    char buffer[256];
+
+    snprintf(buffer, sizeof(buffer), "field-%s", cfgname);
+    astrncpy(field->section, buffer, sizeof(field->section));
+
+    // Get the common properties from config
+    field->delay                    = cfg->GetInt(arena->cfg, buffer, "firedelay", 50);
+    field->duration                 = cfg->GetInt(arena->cfg, buffer, "duration", 1000);
+    field->property                 = cfg->GetInt(arena->cfg, buffer, "property", 1);
+    field->radius                   = cfg->GetInt(arena->cfg, buffer, "radius", 64);
+
+    LoadShape(arena, buffer, field);
+    LoadMotion(arena, buffer, field);
+
+    field->occlude                  = cfg->GetInt(arena->cfg, buffer, "occlude", 0);
+    field->LVZSize                  = cfg->GetInt(arena->cfg, buffer, "lvzsize", 32);
+    field->maxLVZIds                = cfg->GetInt(arena->cfg, buffer, "maxlvzids", 20);
+
+    field->LVZIdBase[UpperLeft]     = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ul", 0);
+    field->LVZIdBase[UpperRight]    = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ur", 0);
+    field->LVZIdBase[LowerRight]    = cfg->GetInt(arena->cfg, buffer, "lvzidbase-lr", 0);
+    field->LVZIdBase[LowerLeft]     = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ll", 0);
+    field->arena                    = arena;
+
+    for (int i = 0; i < 4; i++)
+        field->nextLVZId[i] = field->LVZIdBase[i];
+
+    // Get the event from config
+    const char *str = cfg->GetStr(arena->cfg, buffer, "event");
+    if (str) {
+        astrncpy(field->event, str, 16);
+    } else {
+        lm->LogA(L_ERROR, MODULE_NAME, arena, "Loaded field with unknown event (%s)", cfgname);
+        astrncpy(field->event, cfgname, 16);
+    }
+
+    // Get the field name from config
+    str = cfg->GetStr(arena->cfg, buffer, "name");
+    if (str) {
+        astrncpy(field->name, str, HSFIELD_NAME_SIZE);
+    } else {
+        lm->LogA(L_ERROR, MODULE_NAME, arena, "Loaded field with unknown name (%s)", cfgname);
+        astrncpy(field->name, "unknown", HSFIELD_NAME_SIZE);
+    }
+
+    // Get the class name from config
+    str = cfg->GetStr(arena->cfg, buffer, "class");
+    if (str)
+        astrncpy(field->className, str, 32);
+    else
+        astrncpy(field->className, "attack", 32);
+
+    // Get the field class from the hashtable
+    HSFieldClass *fieldClass = HashGetOne(&g_fieldClasses, field->className);
+    if (!fieldClass)
+        lm->LogA(L_WARN, MODULE_NAME, arena, "%s field's class %s is not loaded.", cfgname, field->className);
+
+    field->fieldClass = fieldClass;
+}
+
+/**
+ * Writes the class name and the values of the class's config keys in a section to key.
+ * Returns 0 if the properties can't be shared, because the class doesn't list its keys or they don't fit.
+ */
+local int PropertiesKey(Arena *arena, const char *section, HSFieldClass *fieldClass, const char *className, char *key, int size) {
+    int len = snprintf(key, size, "%s", className);
+
+    if (!fieldClass || !fieldClass->keys)
+        return 0;
+
+    for (int i = 0; fieldClass->keys[i] && len < size; i++) {
+        const char *value = cfg->GetStr(arena->cfg, section, fieldClass->keys[i]);
+
+        // Separate the values so a missing key can't be confused with an empty one
+        len += snprintf(key + len, size - len, value ? "\x1f%s" : "\x1e", value);
+    }
+
+    return len < size;
+}
+
+/**
+ * Returns the shared property set loaded for a class with these key values, or NULL. Call with pthread_mutex held.
+ */
+local HSFieldProperties *FindProperties(const char *fingerprint, HSFieldClass *fieldClass, const char *key) {
+    HSFieldProperties *set, *result = NULL;
+    LinkedList *matches = HashGet(&g_sharedProperties, fingerprint);
+    Link *link;
+
+    FOR_EACH(matches, set, link) {
+        if (set->fieldClass == fieldClass && strcmp(set->key, key) == 0) {
+            result = set;
+            break;
+        }
+    }
+    LLFree(matches);
+
+    return result;
+}
+
+/**
+ * Returns the class properties for a field type. Reuses a set already loaded by any arena with the same class
+ * and key values, otherwise calls the class property loader.
+ */
+local HashTable *AcquireProperties(Arena *arena, const char *section, HSFieldClass *fieldClass, const char *className) {
+    HSFieldProperties *set, *existing;
+    char key[1024];
+    char fingerprint[20];
+    int shared = PropertiesKey(arena, section, fieldClass, className, key, sizeof(key));
+
+    if (shared) {
+        uint64_t hash = 14695981039346656037ull;
+
+        for (const char *c = key; *c; c++)
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+        snprintf(fingerprint, sizeof(fingerprint), "%016llx", (unsigned long long)hash);
+
+        pthread_mutex_lock(&pthread_mutex);
+        existing = FindProperties(fingerprint, fieldClass, key);
+        if (existing)
+            existing->refs++;
+        pthread_mutex_unlock(&pthread_mutex);
+
+        if (existing)
+            return &existing->table;
+    }
+
+    // The loader reads config and allocates, so don't hold the lock for it here
+    set = amalloc(sizeof(HSFieldProperties));
+    set->fieldClass = fieldClass;
+    set->refs = 1;
+    HashInit(&set->table);
+
+    if (fieldClass && fieldClass->loader)
+        fieldClass->loader(arena, section, &set->table);
+
+    if (!shared)
+        return &set->table;
+
+    pthread_mutex_lock(&pthread_mutex);
+
+    // Another arena may have loaded the same set in the meantime
+    existing = FindProperties(fingerprint, fieldClass, key);
+    if (existing) {
+        existing->refs++;
+    } else {
+        set->key = astrdup(key);
+        astrncpy(set->fingerprint, fingerprint, sizeof(set->fingerprint));
+        HashAdd(&g_sharedProperties, set->fingerprint, set);
+    }
+
+    pthread_mutex_unlock(&pthread_mutex);
+
+    if (existing) {
+        if (fieldClass && fieldClass->cleanup)
+            fieldClass->cleanup(arena, &set->table);
+        HashDeinit(&set->table);
+        afree(set);
+        return &existing->table;
+    }
+
+    return &set->table;
+}
+
+/**
+ * Drops a field type's hold on its class properties. When no field type uses them anymore they are retired,
+ * and the cleanup of fieldClass runs once no reader can still be using them. fieldClass is the type's current
+ * class, which is NULL if the class was unregistered and its cleanup may be gone.
+ */
+local void ReleaseProperties(Arena *arena, HSFieldClass *fieldClass, HashTable *properties) {
+    HSFieldProperties *set;
+    int last;
+
+    if (!properties)
+        return;
+
+    set = PROPERTIES_SET(properties);
+
+    pthread_mutex_lock(&pthread_mutex);
+    last = --set->refs == 0;
+    if (last && set->key)
+        HashRemove(&g_sharedProperties, set->fingerprint, set);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    if (!last)
+        return;
+
+    set->fieldClass = fieldClass;
+    EpochRetire(ReclaimProperties, set, arena);
+}
+
+/**
+ * Allocate a field type and setup all of the variables for it.
+ * Calls the field's class property loader.
+ * Adds the field to a list of field types for the arena.
+ */
+local HSField *LoadField(Arena *arena, char *cfgname, LinkedList *fields) {
+    HSField *field = amalloc(sizeof(HSField));
+
+    ParseField(arena, cfgname, field);
+
+    // Get the class properties, loading them if no arena has them yet
+    field->properties = AcquireProperties(arena, field->section, field->fieldClass, field->className);
+
+    // Add the new field to the field list
+    pthread_mutex_lock(&pthread_mutex);
+    LLAdd(fields, field);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    lm->LogA(L_INFO, MODULE_NAME, arena, "Added field type %s (Type: %s)", field->name, field->fieldClass ? field->className : "NULL");
+
+    return field;
+}
+
+/**
+ * Loads all of the field types for the arena into a list.
+ */
+local int LoadFields(Arena *arena, LinkedList *fields) {
+    const char *fieldsStr = cfg->GetStr(arena->cfg, "hs_field", "fields");
+    const char *temp = 0;
+    char buffer[512];
+
+    if (fieldsStr) {
+        while (strsplit(fieldsStr, " ,\n\t", buffer, 511, &temp))
+            LoadField(arena, buffer, fields);
+    }
+
+    return 1;
+}
+
+/**
+ * Loads the arena's field types into a private list, then publishes them all at once.
+ * Runs on the field loader thread, or on the mainloop if the thread isn't running.
+ */
+local void BuildArenaFields(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    uint64_t start = MonotonicNs();
+    LinkedList built;
+    HSField *field;
+    Link *link;
+    int count = 0;
+
+    LLInit(&built);
+    LoadFields(arena, &built);
+
+    pthread_mutex_lock(&pthread_mutex);
+    FOR_EACH(&built, field, link) {
+        LLAdd(&adata->fields, field);
+        count++;
+    }
+    __atomic_store_n(&adata->fieldsLoading, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    LLEmpty(&built);
+
+    lm->LogA(L_DRIVEL, MODULE_NAME, arena, "Loaded %d field types in %lluus.", count,
+        (unsigned long long)((MonotonicNs() - start) / 1000));
+}
+
+/**
+ * Copies freshly parsed settings into a live field type of the same class, swapping in parsed's properties
+ * if it has any. Returns non-zero if anything changed. Call inside EngineLock.
+ */
+local int PatchField(Arena *arena, HSField *field, HSField *parsed) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    int changed = 0;
+
+#define PATCH(member) \
+    if (field->member != parsed->member) { \
+        field->member = parsed->member; \
+        changed = 1; \
+    }
+
+    PATCH(delay);
+    PATCH(duration);
+    PATCH(property);
+    PATCH(radius);
+    PATCH(shape);
+    PATCH(halfWidth);
+    PATCH(halfHeight);
+    PATCH(innerRadius);
+    PATCH(coneCos);
+    PATCH(contains);
+    PATCH(motion);
+    PATCH(velocityX);
+    PATCH(velocityY);
+    PATCH(occlude);
+    PATCH(LVZSize);
+    PATCH(maxLVZIds);
+
+#undef PATCH
+
+    if (changed)
+        StoreRefreshType(&adata->store, field);
+
+    if (memcmp(field->LVZIdBase, parsed->LVZIdBase, sizeof(field->LVZIdBase)) != 0) {
+        memcpy(field->LVZIdBase, parsed->LVZIdBase, sizeof(field->LVZIdBase));
+        memcpy(field->nextLVZId, parsed->nextLVZId, sizeof(field->nextLVZId));
+        changed = 1;
+    }
+
+    if (strcmp(field->event, parsed->event) != 0) {
+        astrncpy(field->event, parsed->event, sizeof(field->event));
+        changed = 1;
+    }
+
+    if (strcmp(field->name, parsed->name) != 0) {
+        astrncpy(field->name, parsed->name, sizeof(field->name));
+        changed = 1;
+    }
+
+    // Updates that started before the swap may still be reading the old set, so it is retired rather than freed
+    if (parsed->properties) {
+        HashTable *old = field->properties;
+
+        field->properties = parsed->properties;
+        parsed->properties = NULL;
+        ReleaseProperties(arena, field->fieldClass, old);
+        changed = 1;
+    }
+
+    return changed;
+}
+
+/**
+ * Returns non-zero if a field type's class properties no longer match the config.
+ * Properties may be shared with other arenas, so a change swaps in another set instead of editing this one.
+ * A class that doesn't list its keys can't say what changed, and its instances and players may still hold
+ * pointers into the set, so its properties are only reloaded along with the class.
+ */
+local int PropertiesChanged(Arena *arena, HSField *field) {
+    HSFieldProperties *set = PROPERTIES_SET(field->properties);
+    char key[1024];
+    int shared = PropertiesKey(arena, field->section, field->fieldClass, field->className, key, sizeof(key));
+
+    return shared ? !set->key || strcmp(set->key, key) != 0 : set->key != NULL;
+}
+
+/**
+ * Brings the arena's field types in line with the config. New sections are loaded, changed ones are patched
+ * in place, and types no longer listed are removed along with their instances.
+ * Properties of classes that don't list their keys only change when the arena is reattached.
+ */
+local void ReloadFields(Arena *arena, int *added, int *changed, int *removed) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    const char *fieldsStr = cfg->GetStr(arena->cfg, "hs_field", "fields");
+    const char *temp = 0;
+    char buffer[512];
+    char section[256];
+    HSReloadEntry *entries = NULL;
+    int entryCount = 0, entrySize = 0;
+    LinkedList gone;
+    HSField *field;
+    Link *link;
+
+    *added = *changed = *removed = 0;
+
+    LLInit(&gone);
+
+    // Parse and load properties before taking the mutex, since class loaders read config and allocate.
+    // The caller holds the arena's fieldsLoading flag, so no other reload or load changes the types meanwhile.
+    while (fieldsStr && strsplit(fieldsStr, " ,\n\t", buffer, 511, &temp)) {
+        HSReloadEntry *entry;
+        int listed = 0;
+
+        snprintf(section, sizeof(section), "field-%s", buffer);
+        for (int i = 0; i < entryCount && !listed; i++)
+            listed = strcmp(entries[i].parsed->section, section) == 0;
+        if (listed)
+            continue;
+
+        entries = GrowArray(entries, &entrySize, entryCount + 1, sizeof(HSReloadEntry));
+        entry = &entries[entryCount++];
+        entry->field = HSFieldIterate(&adata->fields, GetFieldBySection, section);
+        entry->parsed = amalloc(sizeof(HSField));
+        ParseField(arena, buffer, entry->parsed);
+
+        field = entry->field;
+        entry->replace = field && (strcasecmp(field->className, entry->parsed->className) != 0 ||
+            field->fieldClass != entry->parsed->fieldClass);
+
+        if (!field || entry->replace || PropertiesChanged(arena, field)) {
+            HSField *parsed = entry->parsed;
+            parsed->properties = AcquireProperties(arena, parsed->section, parsed->fieldClass, parsed->className);
+        }
+    }
+
+    // Waits out a running update batch, so updates never see a type half patched.
+    EngineLock();
+
+    FOR_EACH(&adata->fields, field, link) {
+        int listed = 0;
+
+        for (int i = 0; i < entryCount && !listed; i++)
+            listed = entries[i].field == field;
+        if (!listed)
+            LLAdd(&gone, field);
+    }
+
+    for (int i = 0; i < entryCount; i++) {
+        HSReloadEntry *entry = &entries[i];
+
+        if (!entry->field) {
+            LLAdd(&adata->fields, entry->parsed);
+            lm->LogA(L_INFO, MODULE_NAME, arena, "Added field type %s (Type: %s)", entry->parsed->name,
+                entry->parsed->fieldClass ? entry->parsed->className : "NULL");
+            entry->parsed = NULL;
+            (*added)++;
+        } else if (entry->replace) {
+            // Instance data was built by the old class's constructor, so the old type goes along with its instances.
+            // They are retired first, so their destructors still see the type they were made with.
+            HSFieldInstanceIterate(&adata->store, RemoveAllInstancesOfType, entry->field);
+            LLRemove(&adata->fields, entry->field);
+            UnloadFields(&adata->fields, entry->field, arena);
+            LLAdd(&adata->fields, entry->parsed);
+            entry->parsed = NULL;
+            (*changed)++;
+        } else if (PatchField(arena, entry->field, entry->parsed)) {
+            (*changed)++;
+        }
+    }
+
+    FOR_EACH(&gone, field, link) {
+        HSFieldInstanceIterate(&adata->store, RemoveAllInstancesOfType, field);
+        LLRemove(&adata->fields, field);
+        UnloadFields(&adata->fields, field, arena);
+        (*removed)++;
+    }
+
+    pthread_mutex_unlock(&pthread_mutex);
+
+    // Patched types took the properties, so only the parsed settings are left to free
+    for (int i = 0; i < entryCount; i++)
+        afree(entries[i].parsed);
+    afree(entries);
+
+    LLEmpty(&gone);
+}
+
+/**
+ * Calls the field's class update function. Runs on a worker thread as part of RunArenaJob.
+ */
+local void UpdateFieldInstance(HSFieldInstance *inst) {
+    HSFieldArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+
+    // Update instance using the field's class updater
+    if (inst->type && inst->type->fieldClass && inst->type->fieldClass->update) {
+        uint64_t start = g_tracing ? TraceNow() : 0;
+        uint64_t ns = MonotonicNs();
+
+        inst->type->fieldClass->update(inst);
+
+        ns = MonotonicNs() - ns;
+        STAT_ADD(adata->stats, StatUpdates, 1);
+        __atomic_fetch_add(&adata->stats->updateNs[HistBucket(ns)], 1, __ATOMIC_RELAXED);
+
+        HSStatsClass *classStats = StatsGetClass(inst->type->fieldClass);
+        if (classStats) {
+            __atomic_fetch_add(&classStats->updates, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&classStats->updateNs, ns, __ATOMIC_RELAXED);
+        }
+
+        if (start)
+            TraceRecord(inst, TraceUpdate, start, TraceNow(), 0, 0);
+    }
+}
+
+/**
+ * Makes sure an array has room for needed elements, growing it by doubling.
+ */
+local void *GrowArray(void *array, int *size, int needed, size_t elementSize) {
+    if (needed <= *size)
+        return array;
+
+    int newSize = *size ? *size : 16;
+    while (newSize < needed)
+        newSize *= 2;
+
+    *size = newSize;
+    return arealloc(array, newSize * elementSize);
+}
+
+/**
+ * qsort comparator that puts the instance with the earliest deadline first. Ties go by id.
+ */
+local int CompareDeadlines(const void *a, const void *b) {
+    const HSDueInstance *x = (const HSDueInstance *)a;
+    const HSDueInstance *y = (const HSDueInstance *)b;
+    int diff = TICK_DIFF(x->deadline, y->deadline);
+
+    if (diff)
+        return diff < 0 ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/**
+ * Fills the arena's due array with the instances that need an update this tick, earliest deadline first.
+ * Returns the number of due instances.
+ */
+local int CollectDueInstances(HSFieldArenaData *adata, ticks_t now) {
+    HSFieldStore *store = &adata->store;
+    int late = 0;
+
+    adata->dueCount = 0;
+
+    for (int i = 0; i < store->count; i++) {
+        int behind = TICK_DIFF(now, store->nextUpdate[i]);
+
+        if (behind < 0)
+            continue;
+
+        if (adata->dueCount == adata->dueSize)
+            adata->due = GrowArray(adata->due, &adata->dueSize, adata->dueCount + 1, sizeof(HSDueInstance));
+
+        HSDueInstance *due = &adata->due[adata->dueCount++];
+        due->deadline = store->nextUpdate[i];
+        due->id = StoreInstance(store, i)->id;
+        due->index = i;
+
+        if (behind > 0)
+            late = 1;
+    }
+
+    // Without leftovers from earlier ticks every deadline is now, and the order doesn't matter.
+    if (late)
+        qsort(adata->due, adata->dueCount, sizeof(HSDueInstance), CompareDeadlines);
+
+    return adata->dueCount;
+}
+
+/**
+ * Makes sure every snapshot column has room for count players.
+ */
+local void ReserveSnapshot(HSFieldArenaData *adata, int count) {
+    HSFieldSnapshot *snap = &adata->snapshot;
+    int size;
+
+    if (count <= adata->snapshotSize)
+        return;
+
+#define GROW_COLUMN(column) \
+    size = adata->snapshotSize; \
+    snap->column = GrowArray(snap->column, &size, count, sizeof(*snap->column))
+
+    GROW_COLUMN(x);
+    GROW_COLUMN(y);
+    GROW_COLUMN(radius);
+    GROW_COLUMN(pid);
+    GROW_COLUMN(freq);
+    GROW_COLUMN(ship);
+    GROW_COLUMN(rotation);
+    GROW_COLUMN(xspeed);
+    GROW_COLUMN(yspeed);
+    GROW_COLUMN(energy);
+    GROW_COLUMN(players);
+
+#undef GROW_COLUMN
+
+    adata->snapshotSize = size;
+}
+
+/**
+ * Captures the players that field updates can affect. Runs on the mainloop before the updates start,
+ * so the updates never need the player lock.
+ */
+local void BuildSnapshot(Arena *arena, HSFieldArenaData *adata, ticks_t now) {
+    HSFieldSnapshot *snap = &adata->snapshot;
+    HSFreqMembers *members;
+    int listCount = 0;
+    Player *p;
+    Link *link;
+
+    snap->tick = now;
+    snap->count = 0;
+    snap->freqCount = 0;
+
+    // Order the freqs. There are only ever a few, so an insertion sort is enough.
+    FOR_EACH(&adata->freqLists, members, link) {
+        int i = listCount++;
+
+        adata->sortedFreqs = GrowArray(adata->sortedFreqs, &adata->sortedFreqsSize, listCount, sizeof(HSFreqMembers *));
+        while (i > 0 && adata->sortedFreqs[i - 1]->freq > members->freq) {
+            adata->sortedFreqs[i] = adata->sortedFreqs[i - 1];
+            i--;
+        }
+        adata->sortedFreqs[i] = members;
+    }
+
+    // The lists are only changed with pthread_mutex held, which the engine tick holds here, so this needs no player lock.
+    for (int f = 0; f < listCount; f++) {
+        members = adata->sortedFreqs[f];
+
+        snap->freqs = GrowArray(snap->freqs, &adata->freqsSize, snap->freqCount + 1, sizeof(HSFieldSnapshotFreq));
+        HSFieldSnapshotFreq *group = &snap->freqs[snap->freqCount++];
+
+        group->freq = members->freq;
+        group->first = snap->count;
+        group->count = 0;
+
+        FOR_EACH(&members->players, p, link) {
+            int i = snap->count++;
+
+            ReserveSnapshot(adata, snap->count);
+            group->count++;
+
+            snap->x[i] = p->position.x;
+            snap->y[i] = p->position.y;
+            snap->radius[i] = adata->cfgShipRadius[p->p_ship];
+            snap->pid[i] = p->pid;
+            snap->freq[i] = p->p_freq;
+            snap->ship[i] = p->p_ship;
+            snap->rotation[i] = p->position.rotation;
+            snap->xspeed[i] = p->position.xspeed;
+            snap->yspeed[i] = p->position.yspeed;
+            snap->energy[i] = p->position.energy;
+            snap->players[i] = p;
+        }
+    }
+}
+
+/**
+ * Ends the instances whose duration ran out at or before now. Runs on the mainloop before the updates,
+ * so an instance is never updated on or after its end time.
+ */
+local void ExpireInstances(Arena *arena, HSFieldArenaData *adata, ticks_t now) {
+    HSFieldTimer *timer;
+    LinkedList fired;
+    Link *link;
+
+    LLInit(&fired);
+    WheelAdvance(adata->wheel, now, &fired);
+
+    adata->expiredCount = 0;
+    FOR_EACH(&fired, timer, link) {
+        adata->expired = GrowArray(adata->expired, &adata->expiredSize, adata->expiredCount + 1, sizeof(HSFieldInstance *));
+        adata->expired[adata->expiredCount++] = (HSFieldInstance *)((char *)timer - offsetof(HSFieldInstance, expiry));
+    }
+    LLEmpty(&fired);
+
+    for (int i = 0; i < adata->expiredCount; i++) {
+        STAT_ADD(adata->stats, StatExpiries, 1);
+        EndFieldInstance(arena, adata->expired[i]);
+    }
+    adata->expiredCount = 0;
+}
+
+/**
+ * Moves the instances whose type follows the owner or drifts. Runs on the mainloop before the snapshot is taken,
+ * so the updates test the positions of this tick.
+ */
+local void MoveInstances(HSFieldArenaData *adata, ticks_t now) {
+    HSFieldStore *store = &adata->store;
+
+    for (int i = 0; i < store->count; i++) {
+        int x, y;
+
+        if (store->motion[i] == MotionFixed)
+            continue;
+
+        HSFieldInstance *inst = StoreInstance(store, i);
+
+        if (store->motion[i] == MotionFollow) {
+            // Owners that leave end their fields, so the owner is still here
+            if (!inst->player)
+                continue;
+
+            x = inst->player->position.x;
+            y = inst->player->position.y;
+        } else {
+            int64_t elapsed = TICK_DIFF(now, store->startTime[i]);
+
+            x = store->originX[i] + inst->type->velocityX * elapsed / 1000;
+            y = store->originY[i] + inst->type->velocityY * elapsed / 1000;
+        }
+
+        // Stay on the map
+        x = x < 0 ? 0 : (x > 16383 ? 16383 : x);
+        y = y < 0 ? 0 : (y > 16383 ? 16383 : y);
+
+        if (x == store->x[i] && y == store->y[i])
+            continue;
+
+        store->x[i] = inst->x = x;
+        store->y[i] = inst->y = y;
+        store->movedAt[i] = now;
+    }
+}
+
+/**
+ * Sends the corner LVZ of moved instances to their viewers. All the moves since a viewer's last batch are folded
+ * into one move to the current position, and a viewer gets at most one batch every LVZMoveInterval ticks.
+ */
+local void SendFieldMoves(HSFieldArenaData *adata, ticks_t now) {
+    HSFieldStore *store = &adata->store;
+    LinkedList sent;
+    Player *p;
+    Link *link;
+    Target t;
+
+    LLInit(&sent);
+    t.type = T_LIST;
+
+    for (int i = 0; i < store->count; i++) {
+        if (store->motion[i] == MotionFixed)
+            continue;
+
+        HSFieldInstance *inst = StoreInstance(store, i);
+
+        LLInit(&t.u.list);
+
+        FOR_EACH(&inst->viewers, p, link) {
+            HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+
+            // Players that got a batch this tick can take the rest of it, others wait out the interval
+            if (TICK_DIFF(store->movedAt[i], pdata->lastLVZMove) <= 0)
+                continue;
+            if (!pdata->movesSent && TICK_DIFF(now, pdata->lastLVZMove) < adata->LVZMoveInterval)
+                continue;
+
+            LLAdd(&t.u.list, p);
+
+            if (!pdata->movesSent) {
+                pdata->movesSent = 1;
+                LLAdd(&sent, p);
+            }
+        }
+
+        if (LLGetHead(&t.u.list)) {
+            MoveFieldLVZ(inst, &t);
+            STAT_ADD(adata->stats, StatLVZMoves, LLCount(&t.u.list));
+        }
+
+        LLEmpty(&t.u.list);
+    }
+
+    FOR_EACH(&sent, p, link) {
+        HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+
+        pdata->movesSent = 0;
+        pdata->lastLVZMove = now;
+    }
+
+    LLEmpty(&sent);
+}
+
+/**
+ * Counts an instance update as falling on a tick. Use a negative amount when the update moves or goes away.
+ */
+local void PhaseAdd(HSFieldArenaData *adata, ticks_t tick, int amount) {
+    adata->phaseLoad[(unsigned)tick & PHASE_MASK] += amount;
+}
+
+/**
+ * Picks the first update tick for a new instance. Any tick within one delay of the earliest works,
+ * so it takes the one with the fewest updates already on it.
+ */
+local ticks_t PickFirstUpdate(HSFieldArenaData *adata, ticks_t now, int delay) {
+    ticks_t first = now + delay;
+    int window = delay < 1 ? 1 : (delay < PHASE_SLOTS ? delay : PHASE_SLOTS);
+    int best = 0;
+
+    for (int i = 1; i < window && adata->phaseLoad[(unsigned)(first + best) & PHASE_MASK]; i++) {
+        if (adata->phaseLoad[(unsigned)(first + i) & PHASE_MASK] < adata->phaseLoad[(unsigned)(first + best) & PHASE_MASK])
+            best = i;
+    }
+
+    return first + best;
+}
+
+/**
+ * Returns when an instance that was just updated is next due. Keeps the instance on its phase,
+ * unless it fell more than a whole delay behind.
+ */
+local ticks_t NextUpdate(ticks_t last, int delay, ticks_t now) {
+    ticks_t next = last + delay;
+
+    if (TICK_DIFF(next, now) <= 0)
+        next = now + delay;
+
+    return next;
+}
+
+/**
+ * Worker job that updates the due instances of one arena. Anything the updates send is queued on the arena.
+ * Stops once the arena's share of the tick budget is used up, the rest stay due and go first next tick.
+ */
+local void RunArenaJob(void *job) {
+    Arena *arena = (Arena *)job;
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    ticks_t now = adata->snapshot.tick;
+    uint64_t start = MonotonicNs();
+    int deferred = 0;
+
+    t_updatingArena = arena;
+    EpochEnter();
+
+    for (int i = 0; i < adata->dueCount; i++) {
+        HSDueInstance *due = &adata->due[i];
+        HSFieldInstance *inst = StoreInstance(&adata->store, due->index);
+        ticks_t *nextUpdate = &adata->store.nextUpdate[due->index];
+
+        // Always update at least one instance so a slow class still makes progress.
+        if (adata->budgetNs && i > 0 && MonotonicNs() - start >= adata->budgetNs) {
+            deferred = adata->dueCount - i;
+            STAT_ADD(adata->stats, StatDeferredUpdates, deferred);
+            break;
+        }
+
+        __atomic_fetch_add(&adata->stats->lateTicks[HistBucket(TICK_DIFF(now, due->deadline))], 1, __ATOMIC_RELAXED);
+
+        UpdateFieldInstance(inst);
+
+        PhaseAdd(adata, *nextUpdate, -1);
+        *nextUpdate = NextUpdate(*nextUpdate, inst->type->delay, now);
+        PhaseAdd(adata, *nextUpdate, 1);
+    }
+
+    uint64_t elapsed = MonotonicNs() - start;
+    __atomic_fetch_add(&adata->stats->tickNs[HistBucket(elapsed)], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&adata->stats->backlog, deferred, __ATOMIC_RELAXED);
+
+    EpochExit();
+    t_updatingArena = NULL;
+}
+
+/**
+ * Applies the work the arena's updates queued. Runs on the mainloop.
+ */
+local void FinishArenaJob(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldEffectQueue *queue = &adata->effects;
+
+    for (int i = 0; i < queue->count; i++) {
+        HSFieldEffect *effect = &queue->effects[i];
+
+        switch (effect->type) {
+            case EffectSend:
+                if (effect->p->arena == arena)
+                    net->SendToOne(effect->p, effect->u.send.data, effect->u.send.len, effect->u.send.flags);
+            break;
+            case EffectPrize:
+            {
+                Target target;
+
+                target.type = T_LIST;
+                LLInit(&target.u.list);
+
+                for (int j = 0; j < effect->u.prize.count; j++) {
+                    Player *p = queue->players[effect->u.prize.first + j];
+                    if (p->arena == arena)
+                        LLAdd(&target.u.list, p);
+                }
+
+                if (LLGetHead(&target.u.list))
+                    game->GivePrize(&target, effect->u.prize.prize, effect->u.prize.amount);
+
+                LLEmpty(&target.u.list);
+            }
+            break;
+            case EffectDefer:
+                if (!effect->p || effect->p->arena == arena)
+                    effect->u.defer.func(arena, effect->p, effect->u.defer.param);
+            break;
+        }
+    }
+
+    queue->count = 0;
+    queue->playerCount = 0;
+}
+
+/**
+ * Mainloop timer that drives all field updates.
+ * Ends the instances whose time ran out, collects the due instances and a player snapshot for each arena,
+ * updates the arenas in parallel on the worker pool, then drains the queued work one arena at a time in arena list order.
+ */
+local int FieldEngineTick(void *unused) {
+    ticks_t now = current_ticks();
+    HSFieldArenaData *adata;
+    Arena *arena;
+    Link *link;
+    int arenaCount = 0;
+    int jobCount = 0;
+    int totalDue = 0;
+
+    // No updates are running between ticks, so only readers outside the engine can hold anything back
+    EpochReclaim();
+
+    // New instances start after their delay, so spawning them first never changes what updates this tick.
+    DrainSpawnRequests();
+
+    aman->Lock();
+    FOR_EACH_ARENA_P(arena, adata, adkey) {
+        if (!adata->attached)
+            continue;
+
+        g_arenas = GrowArray(g_arenas, &g_arenasSize, arenaCount + 1, sizeof(Arena *));
+        g_arenas[arenaCount++] = arena;
+    }
+    // Arenas are only destroyed by the mainloop, so they stay valid without the arena lock.
+    aman->Unlock();
+
+    pthread_mutex_lock(&pthread_mutex);
+
+    for (int i = 0; i < arenaCount; i++) {
+        arena = g_arenas[i];
+        adata = P_ARENA_DATA(arena, adkey);
+
+        ExpireInstances(arena, adata, now);
+        MoveInstances(adata, now);
+        SendFieldMoves(adata, now);
+
+        if (!CollectDueInstances(adata, now)) {
+            __atomic_store_n(&adata->stats->backlog, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        BuildSnapshot(arena, adata, now);
+
+        g_jobs = GrowArray(g_jobs, &g_jobsSize, jobCount + 1, sizeof(Arena *));
+        g_jobs[jobCount++] = arena;
+    }
+
+    // The workers and this thread run arenas side by side, so there is a budget's worth of time on each of them.
+    // With no more arenas than threads every arena has a thread to itself. Otherwise split the combined time
+    // by how much work each arena has due, so a busy arena can't use up everyone's time.
+    int lanes = g_pool.threadCount + 1;
+
+    for (int i = 0; i < jobCount; i++) {
+        adata = P_ARENA_DATA(g_jobs[i], adkey);
+        totalDue += adata->dueCount;
+    }
+    for (int i = 0; i < jobCount; i++) {
+        adata = P_ARENA_DATA(g_jobs[i], adkey);
+
+        if (jobCount <= lanes) {
+            adata->budgetNs = g_tickBudgetNs;
+            continue;
+        }
+
+        adata->budgetNs = g_tickBudgetNs * lanes * adata->dueCount / totalDue;
+        if (adata->budgetNs > g_tickBudgetNs)
+            adata->budgetNs = g_tickBudgetNs;
+        if (g_tickBudgetNs && !adata->budgetNs)
+            adata->budgetNs = 1;
+    }
+
+    // Run the batch without the mutex, so callbacks on other threads aren't held up by the updates
+    // and an update can use anything that takes it. Store and type changes wait in EngineLock instead.
+    pthread_mutex_lock(&g_batchLock);
+    __atomic_store_n(&g_batchRunning, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_batchLock);
+    pthread_mutex_unlock(&pthread_mutex);
+
+    WorkerPoolRun(&g_pool, RunArenaJob, (void **)g_jobs, jobCount);
+
+    // Retake the mutex before letting the waiters in, so nothing ends between the batch and its queued work.
+    pthread_mutex_lock(&pthread_mutex);
+    pthread_mutex_lock(&g_batchLock);
+    __atomic_store_n(&g_batchRunning, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&g_batchDone);
+    pthread_mutex_unlock(&g_batchLock);
+
+    for (int i = 0; i < jobCount; i++)
+        FinishArenaJob(g_jobs[i]);
+
+    pthread_mutex_unlock(&pthread_mutex);
+
+    return 1;
+}
+
+/**
+ * Spawns the field a ?field request asked for, or tells the player why it can't. Runs on the mainloop.
+ */
+local void HandleSpawnRequest(HSSpawnRequest *req) {
+    Player *p = pd->PidToPlayer(req->pid);
+
+    if (!p)
+        return;
+
+    HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+
+    // The player changed arena, ship or freq since the request was made, which already cancelled it.
+    // The state belongs to a newer request.
+    if (__atomic_load_n(&pdata->spawnSerial, __ATOMIC_ACQUIRE) != req->serial)
+        return;
+
+    if (!p->arena || p->arena != req->arena || HS_IS_SPEC(p) || p->p_ship != req->ship) {
+        __atomic_store_n(&pdata->fieldState, FieldNone, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (pdata->dead) {
+        __atomic_store_n(&pdata->fieldState, FieldNone, __ATOMIC_RELEASE);
+        chat->SendMessage(p, "You cannot launch a field while you're dead!");
+        return;
+    }
+
+    HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
+    HSField *type = NULL;
+    
+    if (*req->name) {
+        type = HSFieldIterate(&adata->fields, GetFieldByName, req->name);
+    } else if (req->fieldMask) {
+        for (int i = 1; i <= req->fieldMask; i *= 2) {
+            if (req->fieldMask & i) {
+                int propertyVal = i;
+                type = HSFieldIterate(&adata->fields, GetFieldByPropertyValue, &propertyVal);
+                break;
+            }
+        }
+    }
+    
+    if (type && type->fieldClass) {
+        if (req->fieldMask & type->property) {
+            pdata->lastField = current_ticks();
+            __atomic_store_n(&pdata->fieldState, FieldActive, __ATOMIC_RELEASE);
+            if (BeginFieldInstance(p->arena, p, type)) {
+                chat->SendMessage(p, "%s field created.", type->name);
+                return;
+            }
+            chat->SendMessage(p, "There are too many fields in the arena.");
+        } else {
+            if (*req->name)
+                chat->SendMessage(p, "You do not have that type of field available.");
+            else
+                chat->SendMessage(p, "You don't have any fields!");
+        }
+    } else {
+        if (type)
+            chat->SendMessage(p, "You don't have any fields!");
+        else
+            chat->SendMessage(p, "That type of field doesn't exist.");
+    }
+
+    __atomic_store_n(&pdata->fieldState, FieldNone, __ATOMIC_RELEASE);
+}
+
+/**
+ * Handles every queued ?field request in the order they were queued.
+ */
+local void DrainSpawnRequests() {
+    HSSpawnRequest *req;
+
+    while ((req = SpawnQueuePop(&g_spawnQueue))) {
+        HandleSpawnRequest(req);
+        afree(req);
+    }
+}
+
+/**
+ * Interface function returning the player snapshot for the current tick.
+ */
+local const HSFieldSnapshot *GetSnapshot(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    return &adata->snapshot;
+}
+
+/**
+ * Interface function that counts a hit in the arena's heatmap.
+ */
+local void RecordHit(HSFieldInstance *inst, int x, int y) {
+    HSFieldArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+    HeatAdd(adata->heatHits, x, y);
+}
+
+/**
+ * Interface function that finds a field instance by its handle without taking the mutex.
+ */
+local HSFieldInstance *GetInstance(Arena *arena, HSFieldHandle handle) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    return StoreLookup(&adata->store, handle);
+}
+
+/**
+ * Interface function that starts a read section.
+ */
+local void BeginRead() {
+    EpochEnter();
+}
+
+/**
+ * Interface function that ends a read section.
+ */
+local void EndRead() {
+    EpochExit();
+}
+
+/**
+ * Returns the queue to put an instance's work on, or NULL if the calling thread isn't updating its arena.
+ */
+local inline HSFieldEffectQueue *GetEffectQueue(HSFieldInstance *inst) {
+    if (!t_updatingArena || t_updatingArena != inst->arena)
+        return NULL;
+
+    HSFieldArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+    return &adata->effects;
+}
+
+/**
+ * Adds an entry to an effect queue.
+ */
+local HSFieldEffect *AddEffect(HSFieldEffectQueue *queue, int type, Player *p) {
+    if (queue->count == queue->size)
+        queue->effects = GrowArray(queue->effects, &queue->size, queue->count + 1, sizeof(HSFieldEffect));
+
+    HSFieldEffect *effect = &queue->effects[queue->count++];
+    effect->type = type;
+    effect->p = p;
+
+    return effect;
+}
+
+/**
+ * Interface function that queues a packet, or sends it right away outside of an update.
+ */
+local void QueueSendToOne(HSFieldInstance *inst, Player *p, byte *data, int len, int flags) {
+    HSFieldEffectQueue *queue = GetEffectQueue(inst);
+
+    if (!queue) {
+        net->SendToOne(p, data, len, flags);
+        return;
+    }
+
+    if (len > HS_FIELD_MAX_PACKET) {
+        lm->LogA(L_ERROR, MODULE_NAME, inst->arena, "Dropped %d byte field packet, the limit is %d.", len, HS_FIELD_MAX_PACKET);
+        return;
+    }
+
+    HSFieldEffect *effect = AddEffect(queue, EffectSend, p);
+    effect->u.send.len = len;
+    effect->u.send.flags = flags;
+    memcpy(effect->u.send.data, data, len);
+}
+
+/**
+ * Interface function that queues a prize, or gives it right away outside of an update.
+ */
+local void QueueGivePrize(HSFieldInstance *inst, const Target *target, int prize, int count) {
+    HSFieldEffectQueue *queue = GetEffectQueue(inst);
+
+    if (!queue) {
+        game->GivePrize(target, prize, count);
+        return;
+    }
+
+    if (target->type != T_PLAYER && target->type != T_LIST) {
+        lm->LogA(L_ERROR, MODULE_NAME, inst->arena, "Field prizes can only target players.");
+        return;
+    }
+
+    HSFieldEffect *effect = AddEffect(queue, EffectPrize, NULL);
+    effect->u.prize.first = queue->playerCount;
+    effect->u.prize.count = 0;
+    effect->u.prize.prize = prize;
+    effect->u.prize.amount = count;
+
+    if (target->type == T_PLAYER) {
+        queue->players = GrowArray(queue->players, &queue->playerSize, queue->playerCount + 1, sizeof(Player *));
+        queue->players[queue->playerCount++] = target->u.p;
+        effect->u.prize.count = 1;
+    } else {
+        Player *p;
+        Link *link;
+
+        FOR_EACH((LinkedList *)&target->u.list, p, link) {
+            queue->players = GrowArray(queue->players, &queue->playerSize, queue->playerCount + 1, sizeof(Player *));
+            queue->players[queue->playerCount++] = p;
+            effect->u.prize.count++;
+        }
+    }
+}
+
+/**
+ * Interface function that queues a function for the mainloop, or calls it right away outside of an update.
+ */
+local void QueueDefer(HSFieldInstance *inst, HSFieldDeferFunc func, Player *p, void *param) {
+    HSFieldEffectQueue *queue = GetEffectQueue(inst);
+
+    if (!queue) {
+        func(inst->arena, p, param);
+        return;
+    }
+
+    HSFieldEffect *effect = AddEffect(queue, EffectDefer, p);
+    effect->u.defer.func = func;
+    effect->u.defer.param = param;
+}
+
+/*******************************/
+
+/**
+ * Starts the worker threads. The thread calling WorkerPoolRun also works, so a pool of zero threads runs everything inline.
+ */
+local int WorkerPoolStart(HSWorkerPool *pool, int threadCount) {
+    memset(pool, 0, sizeof(HSWorkerPool));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (threadCount > MAX_WORKER_THREADS)
+        threadCount = MAX_WORKER_THREADS;
+
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, WorkerPoolMain, pool) != 0)
+            break;
+        pool->threadCount++;
+    }
+
+    return pool->threadCount;
+}
+
+/**
+ * Stops and joins the worker threads.
+ */
+local void WorkerPoolStop(HSWorkerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threadCount; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pool->threadCount = 0;
+}
+
+/**
+ * Takes jobs from a batch until there are none left. Returns how many this thread ran.
+ * The batch is passed in as the caller saw it under the lock, never read from the pool while running.
+ */
+local int WorkerPoolDrain(HSWorkerPool *pool, HSWorkFunc func, void **jobs, int jobCount) {
+    int ran = 0;
+    int index;
+
+    while ((index = __atomic_fetch_add(&pool->nextJob, 1, __ATOMIC_RELAXED)) < jobCount) {
+        func(jobs[index]);
+        ran++;
+    }
+
+    return ran;
+}
+
+/**
+ * Worker thread. Sleeps until a batch starts, then helps drain it.
+ */
+local void *WorkerPoolMain(void *param) {
+    HSWorkerPool *pool = (HSWorkerPool *)param;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit)
+            break;
+
+        seen = pool->generation;
+        if (!pool->open)
+            continue;
+
+        HSWorkFunc func = pool->func;
+        void **jobs = pool->jobs;
+        int jobCount = pool->jobCount;
+
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        int ran = WorkerPoolDrain(pool, func, jobs, jobCount);
+
+        pthread_mutex_lock(&pool->lock);
+        if (seen == pool->generation)
+            pool->finished += ran;
+        if (--pool->active == 0)
+            pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * Runs func on every job and returns once all of them are finished and every worker has left the batch.
+ */
+local void WorkerPoolRun(HSWorkerPool *pool, HSWorkFunc func, void **jobs, int jobCount) {
+    if (jobCount <= 0)
+        return;
+
+    if (!pool->threadCount || jobCount == 1) {
+        for (int i = 0; i < jobCount; i++)
+            func(jobs[i]);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    // nextJob and the batch are about to be reused, so no worker may still be in the last one
+    while (pool->active)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pool->func = func;
+    pool->jobs = jobs;
+    pool->jobCount = jobCount;
+    pool->nextJob = 0;
+    pool->finished = 0;
+    pool->open = 1;
+    pool->active++;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    int ran = WorkerPoolDrain(pool, func, jobs, jobCount);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->finished += ran;
+    pool->active--;
+    while (pool->finished < jobCount || pool->active)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pool->open = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Takes pthread_mutex to change what the updates read: the instance store and the field types.
+ * A running update batch is waited out without holding the mutex, so the batch never waits on the caller.
+ * Holding the mutex already means no batch can have started, so nested calls go straight through.
+ * Code that took the mutex with a plain lock must not call this.
+ */
+local void EngineLock() {
+    pthread_mutex_lock(&pthread_mutex);
+
+    // Updates queue their changes with Defer. Stopping one here would wait on its own batch.
+    while (__atomic_load_n(&g_batchRunning, __ATOMIC_ACQUIRE) && !t_updatingArena) {
+        pthread_mutex_unlock(&pthread_mutex);
+
+        pthread_mutex_lock(&g_batchLock);
+        while (g_batchRunning)
+            pthread_cond_wait(&g_batchDone, &g_batchLock);
+        pthread_mutex_unlock(&g_batchLock);
+
+        pthread_mutex_lock(&pthread_mutex);
+    }
+}
+
+/*******************************/
+
+/**
+ * Puts a player in the list for their current freq, moving them out of any other.
+ */
+local void FreqListAdd(Arena *arena, Player *p) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+    HSFreqMembers *members;
+    Link *link;
+
+    if (p->type == T_FAKE)
+        return;
+
+    // Kill and ship change callbacks come from the net threads while the engine tick may be reading the lists
+    pthread_mutex_lock(&pthread_mutex);
+
+    if (pdata->members && pdata->members->freq == p->p_freq) {
+        pthread_mutex_unlock(&pthread_mutex);
+        return;
+    }
+
+    FreqListRemove(arena, p);
+
+    FOR_EACH(&adata->freqLists, members, link) {
+        if (members->freq == p->p_freq)
+            break;
+    }
+
+    if (!link) {
+        members = amalloc(sizeof(HSFreqMembers));
+        members->freq = p->p_freq;
+        LLInit(&members->players);
+        LLAdd(&adata->freqLists, members);
+    }
 
-// Interface functions
-local int RegisterFieldClass(const char *className, HSFieldClass *fieldClass);
-local void UnregisterFieldClass(const char *className);
+    LLAdd(&members->players, p);
+    pdata->members = members;
 
-/********************************/
+    pthread_mutex_unlock(&pthread_mutex);
+}
 
 /**
- * Call func on each field type until one of the func calls returns non-zero.
+ * Takes a player out of their freq list. Lists are freed once they are empty.
  */
-local HSField *HSFieldIterate(LinkedList *list, HSFieldIterateFunc func, const void *extra) {
-    HSField *result = NULL, *data = NULL;
-    Link *link;
+local void FreqListRemove(Arena *arena, Player *p) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+    HSFreqMembers *members;
 
     pthread_mutex_lock(&pthread_mutex);
-    FOR_EACH(list, data, link) {
-        int found = func(list, data, extra);
-        if (found) {
-            result = data;
-            break;
+
+    members = pdata->members;
+    if (members) {
+        LLRemove(&members->players, p);
+        pdata->members = NULL;
+
+        if (!LLGetHead(&members->players)) {
+            LLRemove(&adata->freqLists, members);
+            afree(members);
         }
     }
+
     pthread_mutex_unlock(&pthread_mutex);
-    return result;
 }
 
 /**
- * A function to be used with HSFieldIterate. Returns the field that matches name.
+ * Fills the freq lists with the players already in the arena when hs_fields attaches.
  */
-local int GetFieldByName(LinkedList *fields, HSField *field, const void *name) {
-    return strcasecmp(field->name, (char *)name) == 0;
-}
+local void FreqListsInit(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    Player *p;
+    Link *link;
 
-/**
- * A function to be used with HSFieldIterate. Returns the field that matches the property value.
- */
-local int GetFieldByPropertyValue(LinkedList *fields, HSField *field, const void *value) {
-    int *pVal = (int *)value;
-    return field->property == *pVal;
+    // pthread_mutex is always taken before the player lock
+    pthread_mutex_lock(&pthread_mutex);
+    LLInit(&adata->freqLists);
+
+    pd->Lock();
+    FOR_EACH_PLAYER_IN_ARENA(p, arena) {
+        HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+
+        pdata->members = NULL;
+        if (!HS_IS_SPEC(p) && !p->flags.is_dead)
+            FreqListAdd(arena, p);
+    }
+    pd->Unlock();
+    pthread_mutex_unlock(&pthread_mutex);
 }
 
 /**
- * A function to be used with HSFieldIterate. Cycles through the object IDs for the field corners.
+ * Frees the freq lists and clears the players' links to them.
  */
-local int UpdateNextLVZId(LinkedList *fields, HSField *field, const void *array) {
-    int *LVZId = (int *)array;
-    
-    for (int i = 0; i < 4; i++) {
-        if (field->LVZIdBase[i] != LVZId[i])
-            continue;
-        field->nextLVZId[i]++;
-        if (field->nextLVZId[i] >= field->LVZIdBase[i] + field->maxLVZIds)
-            field->nextLVZId[i] = field->LVZIdBase[i];
+local void FreqListsClear(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFreqMembers *members;
+    Player *p;
+    Link *link, *playerLink;
+
+    pthread_mutex_lock(&pthread_mutex);
+
+    FOR_EACH(&adata->freqLists, members, link) {
+        FOR_EACH(&members->players, p, playerLink) {
+            HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+            pdata->members = NULL;
+        }
+
+        LLEmpty(&members->players);
+        afree(members);
     }
-    return 0;
+
+    LLEmpty(&adata->freqLists);
+
+    pthread_mutex_unlock(&pthread_mutex);
 }
 
+/*******************************/
+
 /**
- * A function to be used with HSFieldIterate. Frees up the memory used by each field type.
+ * Sets up an empty wheel starting at now.
  */
-local int UnloadFields(LinkedList *list, HSField *field, const void *arena) {
-    if (field && field->fieldClass && field->fieldClass->cleanup)
-        field->fieldClass->cleanup((Arena *)arena, &field->properties);
-    HashDeinit(&field->properties);
-    afree(field);
-    return 0;
+local void WheelInit(HSTimerWheel *wheel, ticks_t now) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int i = 0; i < WHEEL_SIZE; i++)
+            wheel->slots[level][i].prev = wheel->slots[level][i].next = &wheel->slots[level][i];
+    }
+
+    wheel->now = now;
+    wheel->count = 0;
 }
 
-/** 
- * A function to be used with HSFieldIterate. Adds the field class to the fields with that className.
+/**
+ * Links a timer into the slot for its expiry time. Timers already due go in the next tick's slot.
  */
-local int AddFieldClass(LinkedList *fields, HSField *field, const void *className) {
-    if (strcasecmp(field->className, (char *)className) == 0) {
-        HSFieldClass *fClass = HashGetOne(&g_fieldClasses, (char *)className);
-        field->fieldClass = fClass;
+local void WheelAdd(HSTimerWheel *wheel, HSFieldTimer *timer) {
+    int delta = TICK_DIFF(timer->expires, wheel->now);
+    unsigned expires = timer->expires;
+    HSFieldTimer *head;
+    int level = 0;
+
+    if (delta <= 0) {
+        delta = 1;
+        expires = wheel->now + 1;
     }
-    return 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >= (1 << (WHEEL_BITS * (level + 1))))
+        level++;
+
+    // Past the top level's span it waits in the furthest slot and gets placed again when that slot cascades
+    if (delta >= (1 << (WHEEL_BITS * WHEEL_LEVELS)))
+        expires = wheel->now + (1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    head = &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+
+    wheel->count++;
 }
 
-/** 
- * A function to be used with HSFieldIterate. Removes the field class from the fields with that className.
+/**
+ * Unlinks a timer. Does nothing if the timer isn't in the wheel.
  */
-local int RemoveFieldClass(LinkedList *fields, HSField *field, const void *className) {
-    if (strcasecmp(field->className, (char *)className) == 0)
-        field->fieldClass = NULL;
-    return 0;
+local void WheelCancel(HSTimerWheel *wheel, HSFieldTimer *timer) {
+    if (!timer->next)
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+
+    wheel->count--;
 }
 
 /**
- * A function to be used with HSFieldIterate. Removes all field instances that have a type with a specific class.
+ * Moves every timer in the current slot of an upper level down to the level where it now belongs.
+ * Runs before the current tick's level 0 slot, so timers due this tick go in that slot rather than the next.
  */
-local int RemoveClassInstances(LinkedList *fields, HSField *field, const void *fClass) {
-    if (field->fieldClass == fClass) {
-        HSFieldArenaData *adata = P_ARENA_DATA(field->arena, adkey);
-        HSFieldInstanceIterate(&adata->instances, RemoveAllInstancesOfType, field);
+local void WheelCascade(HSTimerWheel *wheel, int level) {
+    HSFieldTimer *head = &wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    HSFieldTimer *timer = head->next;
+    HSFieldTimer *current = &wheel->slots[0][wheel->now & WHEEL_MASK];
+
+    head->prev = head->next = head;
+
+    while (timer != head) {
+        HSFieldTimer *next = timer->next;
+
+        if (TICK_DIFF(timer->expires, wheel->now) <= 0) {
+            timer->prev = current->prev;
+            timer->next = current;
+            current->prev->next = timer;
+            current->prev = timer;
+        } else {
+            wheel->count--;
+            WheelAdd(wheel, timer);
+        }
+
+        timer = next;
     }
-    return 0;
 }
 
-/********************************/
-
 /**
- * Call func on each field instance until one of the func calls returns non-zero.
+ * Processes every tick up to and including to. Unlinks the timers that fire and adds them to fired in expiry order.
  */
-local HSFieldInstance *HSFieldInstanceIterate(LinkedList *list, HSFieldInstanceFunc func, const void *extra) {
-    HSFieldInstance *result = NULL, *data = NULL;
-    Link *link;
+local void WheelAdvance(HSTimerWheel *wheel, ticks_t to, LinkedList *fired) {
+    // Nothing to fire, so skip straight to the target
+    if (!wheel->count) {
+        if (TICK_GT(to, wheel->now))
+            wheel->now = to;
+        return;
+    }
 
-    pthread_mutex_lock(&pthread_mutex);
-    FOR_EACH(list, data, link) {
-        int found = func(list, data, extra);
-        if (found) {
-            result = data;
-            break;
+    while (TICK_GT(to, wheel->now)) {
+        wheel->now++;
+
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((wheel->now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+                break;
+            WheelCascade(wheel, level);
+        }
+
+        HSFieldTimer *head = &wheel->slots[0][wheel->now & WHEEL_MASK];
+
+        while (head->next != head) {
+            HSFieldTimer *timer = head->next;
+
+            WheelCancel(wheel, timer);
+            LLAdd(fired, timer);
         }
     }
-    pthread_mutex_unlock(&pthread_mutex);
-    return result;
 }
 
+/*******************************/
+
 /**
- * A function to be used with HSFieldInstanceIterate. Returns a field instance that the specific player created.
+ * Sets up an empty queue.
  */
-local int GetOneInstanceFromPlayer(LinkedList *list, HSFieldInstance *instance, const void *player) {
-    return instance->player == player;
+local void SpawnQueueInit(HSSpawnQueue *queue) {
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
 }
 
 /**
- * A function to be used with HSFieldInstanceIterate. Removes all of the field instances created by a specific player.
+ * Adds a request to the queue. Safe to call from any number of threads at once and never blocks.
  */
-local int RemoveAllInstancesFromPlayer(LinkedList *list, HSFieldInstance *instance, const void *player) {
-    if (player && (instance->player != player))
-        return 0;
+local void SpawnQueuePush(HSSpawnQueue *queue, HSSpawnRequest *req) {
+    req->next = NULL;
 
-    EndFieldInstance(instance->arena, instance);
-    return 0;
+    HSSpawnRequest *prev = __atomic_exchange_n(&queue->head, req, __ATOMIC_ACQ_REL);
+
+    // Until this store the request is queued but not reachable from tail. Pop treats that as empty.
+    __atomic_store_n(&prev->next, req, __ATOMIC_RELEASE);
 }
 
 /**
- * A function to be used with HSFieldInstanceIterate. Removes all of the field instances of a specific type.
+ * Removes the oldest request from the queue, or returns NULL if there is none.
+ * Only the engine tick may call this. A request whose push is still in progress is left for the next call.
  */
-local int RemoveAllInstancesOfType(LinkedList *list, HSFieldInstance *instance, const void *type) {
-    if (instance->type == type)
-        EndFieldInstance(instance->arena, instance);
-    return 0;
+local HSSpawnRequest *SpawnQueuePop(HSSpawnQueue *queue) {
+    HSSpawnRequest *tail = queue->tail;
+    HSSpawnRequest *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (!next)
+            return NULL;
+
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    // tail is the last request. Put the stub behind it so it can be handed out.
+    SpawnQueuePush(queue, &queue->stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
 }
 
-/********************************/
+/*******************************/
 
 /**
- * Checks if a ship is in a square.
+ * Counts one event in the heatmap cell holding a map position. Positions off the map count at the nearest edge.
  */
-int InSquare(Arena *arena, int ship, int sx, int sy, int r, int x, int y) {
-    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
-    
-    if (ship < SHIP_WARBIRD || ship > SHIP_SHARK)
-        return 0;
+local inline void HeatAdd(uint32_t *grid, int x, int y) {
+    int cx = x >> HEAT_CELL_BITS;
+    int cy = y >> HEAT_CELL_BITS;
 
-    int R = adata->cfgShipRadius[ship];
+    cx = cx < 0 ? 0 : (cx >= HEAT_GRID ? HEAT_GRID - 1 : cx);
+    cy = cy < 0 ? 0 : (cy >= HEAT_GRID ? HEAT_GRID - 1 : cy);
 
-    if ((x + R) < (sx - r))
-        return 0;
-    if ((x - R) > (sx + r))
-        return 0;
-    if ((y + R) < (sy - r))
-        return 0;
-    if ((y - R) > (sy + r))
-        return 0;
+    __atomic_fetch_add(&grid[cy * HEAT_GRID + cx], 1, __ATOMIC_RELAXED);
+}
 
-    return 1;
+/**
+ * Writes a heatmap as a 16 bit binary PGM, one pixel per cell with the counts as the gray values.
+ * Counts above 65535 are clipped. Returns the total count, or -1 if the file couldn't be written.
+ */
+local int HeatmapDump(const uint32_t *grid, const char *filename) {
+    unsigned char row[HEAT_GRID * 2];
+    uint32_t counts[HEAT_CELLS];
+    uint32_t max = 1;
+    int total = 0;
+
+    for (int i = 0; i < HEAT_CELLS; i++) {
+        counts[i] = __atomic_load_n(&grid[i], __ATOMIC_RELAXED);
+        total += counts[i];
+        if (counts[i] > max)
+            max = counts[i];
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+        return -1;
+
+    fprintf(f, "P5\n%d %d\n%u\n", HEAT_GRID, HEAT_GRID, max > 65535 ? 65535 : max);
+
+    for (int y = 0; y < HEAT_GRID; y++) {
+        for (int x = 0; x < HEAT_GRID; x++) {
+            uint32_t count = counts[y * HEAT_GRID + x];
+
+            if (count > 65535)
+                count = 65535;
+
+            // PGM samples are big endian
+            row[x * 2] = count >> 8;
+            row[x * 2 + 1] = count & 0xFF;
+        }
+
+        fwrite(row, 1, sizeof(row), f);
+    }
+
+    if (fclose(f) != 0)
+        return -1;
+
+    return total;
 }
 
 /*******************************/
 
 /**
- * Allocate a field type and setup all of the variables for it.
- * Calls the field's class property loader.
- * Adds the field to the list of usable field types for the arena.
+ * Creates a field instance in the arena's store and calls the field's class constructor.
+ * The engine tick starts updating it after the type's delay. Returns 0 if the store is full.
  */
-local int LoadField(Arena *arena, char *cfgname) {
+local int BeginFieldInstance(Arena *arena, Player *p, HSField *type) {
     HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
-    HSField *field = amalloc(sizeof(HSField));
-    char buffer[256];
+    HSFieldInstance init, *newInst;
+    uint64_t start = g_tracing ? TraceNow() : 0;
+    char nameBuffer[24];
+    Player *viewer;
+    Link *link;
+    Target t; 
 
-    sprintf(buffer, "field-%s", cfgname);
+    snprintf(nameBuffer, sizeof(nameBuffer)-1, "<%i-%.17s>", p->pid, type->name);
+    nameBuffer[sizeof(nameBuffer) - 1] = 0;
 
-    // Get the common properties from config
-    field->delay                    = cfg->GetInt(arena->cfg, buffer, "firedelay", 50);
-    field->duration                 = cfg->GetInt(arena->cfg, buffer, "duration", 1000);
-    field->property                 = cfg->GetInt(arena->cfg, buffer, "property", 1);
-    field->radius                   = cfg->GetInt(arena->cfg, buffer, "radius", 64);
+    for (int i = 1; i < (int)sizeof(nameBuffer); i++)
+        nameBuffer[i] = tolower(nameBuffer[i]);
 
-    field->LVZSize                  = cfg->GetInt(arena->cfg, buffer, "lvzsize", 32);
-    field->maxLVZIds                = cfg->GetInt(arena->cfg, buffer, "maxlvzids", 20);
+    // Built here and copied into the store once it's locked
+    memset(&init, 0, sizeof(init));
 
-    field->LVZIdBase[UpperLeft]     = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ul", 0);
-    field->LVZIdBase[UpperRight]    = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ur", 0);
-    field->LVZIdBase[LowerRight]    = cfg->GetInt(arena->cfg, buffer, "lvzidbase-lr", 0);
-    field->LVZIdBase[LowerLeft]     = cfg->GetInt(arena->cfg, buffer, "lvzidbase-ll", 0);
-    field->arena                    = arena;
+    init.fake = fake->CreateFakePlayer(nameBuffer, p->arena, SHIP_SHARK, p->p_freq);
+    init.id = __atomic_add_fetch(&g_nextInstanceId, 1, __ATOMIC_RELAXED);
+    init.player = p;
+    init.arena = arena;
+    init.type = type;
+    init.endTime = current_ticks() + type->duration;
+    init.x = p->position.x;
+    init.y = p->position.y;
+    init.freq = p->p_freq;
 
-    for (int i = 0; i < 4; i++)
-        field->nextLVZId[i] = field->LVZIdBase[i];
+    // Rotation 0 faces up and each step turns 9 degrees clockwise
+    init.dirX = SinQ10(p->position.rotation * 9);
+    init.dirY = -SinQ10(90 - p->position.rotation * 9);
 
-    // Get the event from config
-    const char *str = cfg->GetStr(arena->cfg, buffer, "event");
-    if (str) {
-        astrncpy(field->event, str, 16);
-    } else {
-        lm->LogA(L_ERROR, MODULE_NAME, arena, "Loaded field with unknown event (%s)", cfgname);
-        astrncpy(field->event, cfgname, 16);
+    if (type->occlude && type->motion == MotionFixed)
+        init.mask = AcquireMask(arena, type, init.x, init.y);
+
+    LLInit(&init.viewers);
+
+    pd->Lock();
+    FOR_EACH_PLAYER_IN_ARENA(viewer, arena) {
+        if (viewer->type == T_FAKE)
+            continue;
+        if (InViewRange(adata, init.x, init.y, type->halfWidth, type->halfHeight, viewer))
+            ViewerAdd(&init, viewer);
     }
+    pd->Unlock();
 
-    // Get the field name from config
-    str = cfg->GetStr(arena->cfg, buffer, "name");
-    if (str) {
-        astrncpy(field->name, str, HSFIELD_NAME_SIZE);
-    } else {
-        lm->LogA(L_ERROR, MODULE_NAME, arena, "Loaded field with unknown name (%s)", cfgname);
-        astrncpy(field->name, "unknown", HSFIELD_NAME_SIZE);
+    EngineLock();
+
+    ticks_t firstUpdate = PickFirstUpdate(adata, current_ticks(), type->delay);
+
+    newInst = StoreAdd(&adata->store, &init, firstUpdate);
+    if (!newInst) {
+        pthread_mutex_unlock(&pthread_mutex);
+
+        lm->LogA(L_WARN, MODULE_NAME, arena, "Unable to create field instance %s, the arena already has %d.", nameBuffer, STORE_MAX_SLOTS);
+        LLEmpty(&init.viewers);
+        afree(init.viewerBits);
+        ReleaseMask(arena, init.mask);
+        if (init.fake)
+            fake->EndFaked(init.fake);
+
+        return 0;
     }
 
-    // Get the class name from config
-    str = cfg->GetStr(arena->cfg, buffer, "class");
-    if (str)
-        astrncpy(field->className, str, 32);
-    else
-        astrncpy(field->className, "attack", 32);
+    PhaseAdd(adata, firstUpdate, 1);
+    HeatAdd(adata->heatLaunches, init.x, init.y);
+
+    for (int i = 0; i < 4; i++)
+        newInst->LVZIds[i] = type->nextLVZId[i];
+
+    // Only players near the field see it. The visibility timer handles everyone else as they move.
+    t.type = T_LIST;
+    t.u.list = newInst->viewers;
+    ShowFieldLVZ(newInst, &t);
+
+    HSFieldIterate(&adata->fields, UpdateNextLVZId, type->LVZIdBase);
+
+    newInst->expiry.expires = newInst->endTime;
+    WheelAdd(adata->wheel, &newInst->expiry);
+
+    if (newInst->fake)
+        __atomic_fetch_add(&adata->stats->fakes, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&adata->stats->live, 1, __ATOMIC_RELAXED);
+    STAT_ADD(adata->stats, StatSpawns, 1);
+
+    int used = __atomic_add_fetch(&g_stats->instancesUsed, 1, __ATOMIC_RELAXED);
+    if (used > __atomic_load_n(&g_stats->instancesPeak, __ATOMIC_RELAXED))
+        __atomic_store_n(&g_stats->instancesPeak, used, __ATOMIC_RELAXED);
+
+    // Call instance constructor for field class
+    if (type->fieldClass && type->fieldClass->constructor)
+        type->fieldClass->constructor(newInst);
+
+    pthread_mutex_unlock(&pthread_mutex);
+
+    if (*type->event)
+        items->triggerEvent(p, p->p_ship, type->event);
+
+    if (start)
+        TraceRecord(newInst, TraceBegin, start, TraceNow(), p->pid, 0);
+
+    return 1;
+}
+
+/**
+ * Destroy a field instance by turning off the objects, removing it from the arena, and 
+ * calling the field's class destructor.
+ */
+local void EndFieldInstance(Arena *arena, HSFieldInstance *inst) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    uint64_t start = g_tracing ? TraceNow() : 0;
+    Target t;
+    int index;
+
+    // Remove field instance from the arena's store, and its expiry timer if it ended early
+    EngineLock();
+    index = StoreIndex(&adata->store, inst);
+    if (index < 0) {
+        pthread_mutex_unlock(&pthread_mutex);
+        lm->LogA(L_WARN, MODULE_NAME, arena, "Tried to end field instance %u, which already ended.", inst->id);
+        return;
+    }
+    PhaseAdd(adata, adata->store.nextUpdate[index], -1);
+    StoreRemove(&adata->store, inst);
+    WheelCancel(adata->wheel, &inst->expiry);
+    pthread_mutex_unlock(&pthread_mutex);
+    
+    t.type = T_LIST; 
+    t.u.list = inst->viewers;
+
+    // Turn off the field lvz for the players that can see it
+    HideFieldLVZ(inst, &t);
+    LLEmpty(&inst->viewers);
+    afree(inst->viewerBits);
+    inst->viewerBits = NULL;
+    inst->viewerWords = 0;
+
+    if (inst->fake) {
+        lm->LogA(L_DRIVEL, MODULE_NAME, arena, "Destroyed field instance %s", inst->fake->name);
+        fake->EndFaked(inst->fake);
+        __atomic_fetch_sub(&adata->stats->fakes, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&adata->stats->live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&g_stats->instancesUsed, 1, __ATOMIC_RELAXED);
+
+    // Let the owner launch again
+    if (inst->player) {
+        HSFieldPlayerData *owner = PPDATA(inst->player, pdkey);
+        int expected = FieldActive;
+        __atomic_compare_exchange_n(&owner->fieldState, &expected, FieldNone, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
 
-    // Get the field class from the hashtable
-    HSFieldClass *fieldClass = HashGetOne(&g_fieldClasses, field->className);
-    if (!fieldClass)
-        lm->LogA(L_WARN, MODULE_NAME, arena, "%s field's class %s is not loaded.", cfgname, field->className);
+    if (start)
+        TraceRecord(inst, TraceEnd, start, TraceNow(), 0, 0);
 
-    field->fieldClass = fieldClass;
+    // Readers that looked the instance up before it was removed may still be using it and its class data,
+    // so the class destructor runs when it is reclaimed
+    EpochRetire(ReclaimSlot, inst, &adata->store);
+}
 
-    // Call the property loader for the class
-    HashInit(&field->properties);
+/**
+ * Moves the field's corner LVZ around its bounding box.
+ */
+local void MoveFieldLVZ(HSFieldInstance *inst, Target *target) {
+    HSField *type = inst->type;
 
-    if (field->fieldClass && field->fieldClass->loader)
-        field->fieldClass->loader(arena, buffer, &field->properties);
+    obj->Move(target, inst->LVZIds[UpperLeft], inst->x - type->halfWidth, inst->y - type->halfHeight, 0, 0);
+    obj->Move(target, inst->LVZIds[UpperRight], inst->x + type->halfWidth - type->LVZSize, inst->y - type->halfHeight, 0, 0);
+    obj->Move(target, inst->LVZIds[LowerRight], inst->x + type->halfWidth - type->LVZSize, inst->y + type->halfHeight - type->LVZSize, 0, 0);
+    obj->Move(target, inst->LVZIds[LowerLeft], inst->x - type->halfWidth, inst->y + type->halfHeight - type->LVZSize, 0, 0);
+}
 
-    // Add the new field to arena field list
-    pthread_mutex_lock(&pthread_mutex);
-    LLAdd(&adata->fields, field);
-    pthread_mutex_unlock(&pthread_mutex);
+/**
+ * Moves the field's corner LVZ into place and turns them on.
+ */
+local void ShowFieldLVZ(HSFieldInstance *inst, Target *target) {
+    char ons[4] = { 1, 1, 1, 1 };
 
-    lm->LogA(L_INFO, MODULE_NAME, arena, "Added field type %s (Type: %s)", field->name, field->fieldClass ? field->className : "NULL");
+    if (target->type == T_LIST && !LLGetHead(&target->u.list))
+        return;
 
-    return 1;
+    MoveFieldLVZ(inst, target);
+    obj->ToggleSet(target, inst->LVZIds, ons, 4);
 }
 
 /**
- * Loads all of the field types for the arena.
+ * Turns off the field's corner LVZ.
  */
-local int LoadFields(Arena *arena) {
-    const char *fieldsStr = cfg->GetStr(arena->cfg, "hs_field", "fields");
-    const char *temp = 0;
-    char buffer[512];
+local void HideFieldLVZ(HSFieldInstance *inst, Target *target) {
+    char ons[4] = { 0, 0, 0, 0 };
 
-    if (fieldsStr) {
-        while (strsplit(fieldsStr, " ,\n\t", buffer, 511, &temp))
-            LoadField(arena, buffer);
-    }
+    if (target->type == T_LIST && !LLGetHead(&target->u.list))
+        return;
 
-    return 1;
+    obj->ToggleSet(target, inst->LVZIds, ons, 4);
 }
 
 /**
- * Timer used for updating a field instance. Calls the field's class update function.
+ * Checks if a player is close enough to a field instance to see it.
  */
-local int UpdateFieldInstance(void *param) {
-    HSFieldInstance *inst = (HSFieldInstance *)param;
-    if (!inst)
-        return 0;
-    if (current_ticks() > inst->endTime) {
-        // Remove field from game
-        EndFieldInstance(inst->arena, inst);
-        return 0;
-    }
+local int InViewRange(HSFieldArenaData *adata, int x, int y, int halfWidth, int halfHeight, Player *p) {
+    int w = halfWidth + adata->viewDistance;
+    int h = halfHeight + adata->viewDistance;
+    int dx = p->position.x - x;
+    int dy = p->position.y - y;
 
-    // Update instance using the field's class updater
-    if (inst->type && inst->type->fieldClass && inst->type->fieldClass->update)
-        inst->type->fieldClass->update(inst);
+    return dx >= -w && dx <= w && dy >= -h && dy <= h;
+}
 
-    return 1;
+/**
+ * Checks if a player is one of an instance's viewers.
+ */
+local int IsViewer(const HSFieldInstance *inst, Player *p) {
+    int word = p->pid >> 5;
+
+    return word < inst->viewerWords && (inst->viewerBits[word] >> (p->pid & 31) & 1);
 }
 
 /**
- * Allocates a field instance, and adds it to the list of field instances for the arena.
- * Calls the field's class constructor. Starts the timer for updating the instance.
+ * Adds a player to an instance's viewers.
  */
-local void BeginFieldInstance(Arena *arena, Player *p, HSField *type) {
-    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
-    HSFieldInstance *newInst = amalloc(sizeof(HSFieldInstance));
-    char nameBuffer[24];
-    Target t; 
+local void ViewerAdd(HSFieldInstance *inst, Player *p) {
+    int word = p->pid >> 5;
 
-    t.type = T_ARENA; 
-    t.u.arena = arena;
+    if (IsViewer(inst, p))
+        return;
 
-    snprintf(nameBuffer, sizeof(nameBuffer)-1, "<%i-%.17s>", p->pid, type->name);
-    nameBuffer[sizeof(nameBuffer) - 1] = 0;
+    if (word >= inst->viewerWords) {
+        int size = inst->viewerWords;
 
-    for (int i = 1; i < sizeof(nameBuffer); i++)
-        nameBuffer[i] = tolower(nameBuffer[i]);
+        inst->viewerBits = GrowArray(inst->viewerBits, &size, word + 1, sizeof(uint32_t));
+        memset(inst->viewerBits + inst->viewerWords, 0, (size - inst->viewerWords) * sizeof(uint32_t));
+        inst->viewerWords = size;
+    }
 
-    newInst->fake = fake->CreateFakePlayer(nameBuffer, p->arena, SHIP_SHARK, p->p_freq);
-    newInst->player = p;
-    newInst->arena = arena;
-    newInst->type = type;
-    newInst->endTime = current_ticks() + type->duration;
-    newInst->x = p->position.x;
-    newInst->y = p->position.y;
+    inst->viewerBits[word] |= 1u << (p->pid & 31);
+    LLAdd(&inst->viewers, p);
+}
 
-    if (*type->event)
-        items->triggerEvent(p, p->p_ship, type->event);
+/**
+ * Removes a player from an instance's viewers.
+ */
+local void ViewerRemove(HSFieldInstance *inst, Player *p) {
+    if (!IsViewer(inst, p))
+        return;
 
-    pthread_mutex_lock(&pthread_mutex);
+    inst->viewerBits[p->pid >> 5] &= ~(1u << (p->pid & 31));
+    LLRemove(&inst->viewers, p);
+}
 
-    for (int i = 0; i < 4; i++) {
-        newInst->LVZIds[i] = type->nextLVZId[i];
+/**
+ * Sends the field's LVZ to players that came into view and turns it off for players that left.
+ */
+local void UpdateViewers(Arena *arena, int index) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    HSFieldStore *store = &adata->store;
+    HSFieldInstance *inst = StoreInstance(store, index);
+    LinkedList entered, left;
+    Player *p;
+    Link *link;
+    Target t;
 
-        obj->Toggle(&t, newInst->LVZIds[i], 1);
+    LLInit(&entered);
+    LLInit(&left);
 
-        switch (i) {
-            case UpperLeft:
-                obj->Move(&t, newInst->LVZIds[i], newInst->x - type->radius, newInst->y - type->radius, 0, 0);
-            break;
-            case UpperRight:
-                obj->Move(&t, newInst->LVZIds[i], newInst->x + type->radius - type->LVZSize, newInst->y - type->radius, 0, 0);
-            break;
-            case LowerRight:
-                obj->Move(&t, newInst->LVZIds[i], newInst->x + type->radius - type->LVZSize, newInst->y + type->radius - type->LVZSize, 0, 0);
-            break;
-            case LowerLeft:
-                obj->Move(&t, newInst->LVZIds[i], newInst->x - type->radius, newInst->y + type->radius - type->LVZSize, 0, 0);
-            break;
-        }
+    pd->Lock();
+    FOR_EACH_PLAYER_IN_ARENA(p, arena) {
+        if (p->type == T_FAKE)
+            continue;
+
+        int inRange = InViewRange(adata, store->x[index], store->y[index], store->halfWidth[index], store->halfHeight[index], p);
+        int viewing = IsViewer(inst, p);
+
+        if (inRange && !viewing)
+            LLAdd(&entered, p);
+        else if (!inRange && viewing)
+            LLAdd(&left, p);
     }
+    pd->Unlock();
 
-    HSFieldIterate(&adata->fields, UpdateNextLVZId, type->LVZIdBase);
-    LLAdd(&adata->instances, newInst);
+    t.type = T_LIST;
 
-    // Call instance constructor for field class
-    if (type->fieldClass && type->fieldClass->constructor)
-        type->fieldClass->constructor(newInst);
+    t.u.list = entered;
+    ShowFieldLVZ(inst, &t);
 
-    pthread_mutex_unlock(&pthread_mutex);
+    t.u.list = left;
+    HideFieldLVZ(inst, &t);
+
+    FOR_EACH(&entered, p, link)
+        ViewerAdd(inst, p);
+    FOR_EACH(&left, p, link)
+        ViewerRemove(inst, p);
 
-    ml->SetTimer(UpdateFieldInstance, type->delay, type->delay, newInst, newInst);
+    LLEmpty(&entered);
+    LLEmpty(&left);
 }
 
 /**
- * Destroy a field instance by turning off the objects, clearing the update timer, and 
- * calling the field's class destructor.
+ * Mainloop timer that keeps the viewers of every field instance up to date.
  */
-local void EndFieldInstance(Arena *arena, HSFieldInstance *inst) {
-    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
-    short ids[4] = { inst->LVZIds[0], inst->LVZIds[1], inst->LVZIds[2], inst->LVZIds[3] };
-    char ons[4] = { 0, 0, 0, 0 };
-    Target t;
-    
-    t.type = T_ARENA; 
-    t.u.arena = arena;
+local int VisibilityTimer(void *unused) {
+    HSFieldArenaData *adata;
+    Arena *arena;
+    Link *link;
+
+    aman->Lock();
+    pthread_mutex_lock(&pthread_mutex);
 
-    // Stop updating the field instance
-    ml->ClearTimer(UpdateFieldInstance, inst);
-    // Turn off the field lvz
-    obj->ToggleSet(&t, ids, ons, 4);
+    FOR_EACH_ARENA_P(arena, adata, adkey) {
+        if (!adata->attached)
+            continue;
 
-    lm->LogA(L_DRIVEL, MODULE_NAME, arena, "Destroyed field instance %s", inst->fake->name);
-    fake->EndFaked(inst->fake);
+        for (int i = 0; i < adata->store.count; i++)
+            UpdateViewers(arena, i);
+    }
 
-    // Remove field instance from arena instance list
-    pthread_mutex_lock(&pthread_mutex);
-    LLRemove(&adata->instances, inst);
     pthread_mutex_unlock(&pthread_mutex);
+    aman->Unlock();
 
-    // Call destructor in field class
-    if (inst->type && inst->type->fieldClass && inst->type->fieldClass->destructor)
-        inst->type->fieldClass->destructor(inst);
-
-    afree(inst);
+    return 1;
 }
 
 /**
@@ -507,7 +4770,7 @@ local int HandleRespawn(void *_p) {
     if (!p->arena)
         return 0;
 
-    HSFieldInstanceIterate(&adata->instances, RemoveAllInstancesFromPlayer, p);
+    HSFieldInstanceIterate(&adata->store, RemoveAllInstancesFromPlayer, p);
     pdata->dead = 0;
 
     return 0;
@@ -522,7 +4785,13 @@ local int HandleRespawn(void *_p) {
 local void OnShipFreqChange(Player *p, int newShip, int oldShip, int newFreq, int oldFreq) {
     HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
 
-    HSFieldInstanceIterate(&adata->instances, RemoveAllInstancesFromPlayer, p);
+    CancelSpawnRequest(p);
+    HSFieldInstanceIterate(&adata->store, RemoveAllInstancesFromPlayer, p);
+
+    if (newShip == SHIP_SPEC)
+        FreqListRemove(p->arena, p);
+    else
+        FreqListAdd(p->arena, p);
 }
 
 /**
@@ -541,9 +4810,19 @@ local void OnPlayerAction(Player *p, int action, Arena *arena) {
         if (action == PA_ENTERARENA) {
             pdata->dead = 0;
             pdata->lastField = 0;
+            pdata->lastLVZMove = current_ticks();
+            pdata->movesSent = 0;
+            CancelSpawnRequest(p);
+            __atomic_store_n(&pdata->fieldState, FieldNone, __ATOMIC_RELEASE);
+
+            if (!HS_IS_SPEC(p))
+                FreqListAdd(arena, p);
         } else if (action == PA_LEAVEARENA) {
             ml->ClearTimer(HandleRespawn, p);
-            HSFieldInstanceIterate(&adata->instances, RemoveAllInstancesFromPlayer, p);
+            CancelSpawnRequest(p);
+            FreqListRemove(arena, p);
+            HSFieldInstanceIterate(&adata->store, RemoveAllInstancesFromPlayer, p);
+            HSFieldInstanceIterate(&adata->store, RemoveViewer, p);
         }
     }
 }
@@ -553,7 +4832,10 @@ local void OnPlayerAction(Player *p, int action, Arena *arena) {
  * Starts the timer to remove all of the field instances of the dead player.
  */
 local void OnPlayerKill(Arena *arena, Player *killer, Player *killed, int bounty, int flags, int *pts, int *green) {
-    int enterDelay = cfg->GetInt(killed->arena->cfg, "Kill", "EnterDelay", 0);
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+    int enterDelay = adata->cfgEnterDelay;
+
+    FreqListRemove(arena, killed);
 
     if (enterDelay > 0) {
         HSFieldPlayerData *pdata = PPDATA(killed, pdkey);
@@ -562,6 +4844,40 @@ local void OnPlayerKill(Arena *arena, Player *killer, Player *killed, int bounty
     }
 }
 
+/**
+ * Callback called when a player spawns. Puts them back in their freq list after dying.
+ */
+local void OnPlayerSpawn(Player *p, int reason) {
+    if (p->arena && !HS_IS_SPEC(p))
+        FreqListAdd(p->arena, p);
+}
+
+/**
+ * Callback called when something happens to the arena. Reloads the cached config when it changes.
+ */
+local void OnArenaAction(Arena *arena, int action) {
+    if (action == AA_CONFCHANGED)
+        LoadArenaConfig(arena);
+}
+
+/**
+ * Caches the arena config values used by hs_fields, so events never need to look them up.
+ * Field types are only loaded on attach.
+ */
+local void LoadArenaConfig(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+
+    adata->viewDistance = cfg->GetInt(arena->cfg, "hs_fields", "ViewDistance", 1024);
+    adata->LVZMoveInterval = cfg->GetInt(arena->cfg, "hs_fields", "LVZMoveInterval", 20);
+    adata->cfgEnterDelay = cfg->GetInt(arena->cfg, "Kill", "EnterDelay", 0);
+
+    for (int i = 0; i < 8; i++) {
+        adata->cfgShipRadius[i] = cfg->GetInt(arena->cfg, cfg->SHIP_NAMES[i], "radius", 14);
+        if (!adata->cfgShipRadius[i])
+            adata->cfgShipRadius[i] = 14;
+    }
+}
+
 /*******************************/
 
 /**
@@ -570,7 +4886,11 @@ local void OnPlayerKill(Arena *arena, Player *killer, Player *killed, int bounty
 local int RegisterFieldClass(const char *className, HSFieldClass *fieldClass) {
     lm->Log(L_INFO, "Registered field class %s", className);
 
+    // Types still being loaded wouldn't get the class
+    LoaderWaitIdle();
+
     HashAdd(&g_fieldClasses, className, fieldClass);
+    StatsBindClass(className, fieldClass);
     
     Link *link;
     Arena *arena;
@@ -593,26 +4913,48 @@ local void UnregisterFieldClass(const char *className) {
     HSFieldClass *fClass = HashGetOne(&g_fieldClasses, className);
     if (!fClass) return;
 
+    // The loader may be running the class's property loader
+    LoaderWaitIdle();
+
     Link *link;
     Arena *arena;
     HSFieldArenaData *adata;
     
     aman->Lock();
-    FOR_EACH_ARENA_P(arena, adata, adkey) {
+    FOR_EACH_ARENA_P(arena, adata, adkey)
         HSFieldIterate(&adata->fields, RemoveClassInstances, fClass);
+    aman->Unlock();
+
+    // The instances' destructors and the property cleanups are the class's code, so they run before it goes
+    EpochDrain(NULL, fClass);
+
+    aman->Lock();
+    FOR_EACH_ARENA_P(arena, adata, adkey) {
         // Set all the classes for the fields with this class to NULL.
         HSFieldIterate(&adata->fields, RemoveFieldClass, className);
     }
     aman->Unlock();
     
     HashRemove(&g_fieldClasses, className, fClass);
+    StatsUnbindClass(fClass);
 }
 
 local Ihsfields fields_interface = {
     INTERFACE_HEAD_INIT(I_HSFIELDS, "hsfields")
 
     RegisterFieldClass,
-    UnregisterFieldClass
+    UnregisterFieldClass,
+    &g_tracing,
+    TraceEvent,
+    AddStat,
+    GetSnapshot,
+    QueueSendToOne,
+    QueueGivePrize,
+    QueueDefer,
+    GetInstance,
+    BeginRead,
+    EndRead,
+    RecordHit
 };
 
 /********************************/
@@ -626,10 +4968,16 @@ local helptext_t field_help =
 local void Cfield(const char *cmd, const char *params, Player *p, const Target *target) {
     HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
     HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+    int expected = FieldNone;
 
     if (HS_IS_SPEC(p))
         return;
 
+    if (__atomic_load_n(&adata->fieldsLoading, __ATOMIC_ACQUIRE)) {
+        chat->SendMessage(p, "Fields are still loading in this arena, try again in a moment.");
+        return;
+    }
+
     if (!items->getPropertySum(p, p->p_ship, "fieldlauncher", 0)) {
         chat->SendMessage(p, "You need a Field Launcher to use fields!");
         return;
@@ -646,47 +4994,282 @@ local void Cfield(const char *cmd, const char *params, Player *p, const Target *
         return;
     }
 
-    HSFieldInstance *prev = HSFieldInstanceIterate(&adata->instances, GetOneInstanceFromPlayer, p);
-    if (prev) {
+    if (!__atomic_compare_exchange_n(&pdata->fieldState, &expected, FieldPending, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
         chat->SendMessage(p, "You may only launch one field at a time!");
         return;
     }
 
-    HSField *type = NULL;
-    
-    if (*params) {
-        type = HSFieldIterate(&adata->fields, GetFieldByName, params);
-    } else {
-        int sum = items->getPropertySum(p, p->p_ship, "field", 0);
-        if (sum) {
-            for (int i = 1; i <= sum; i *= 2) {
-                if (sum & i) {
-                    int propertyVal = i;
-                    type = HSFieldIterate(&adata->fields, GetFieldByPropertyValue, &propertyVal);
-                    break;
-                }
-            }
+    // The field type is picked and spawned by the engine tick, which owns the field and instance lists.
+    HSSpawnRequest *req = amalloc(sizeof(HSSpawnRequest));
+
+    req->arena = p->arena;
+    req->pid = p->pid;
+    req->ship = p->p_ship;
+    req->serial = __atomic_add_fetch(&g_nextSpawnSerial, 1, __ATOMIC_RELAXED);
+    req->fieldMask = items->getPropertySum(p, p->p_ship, "field", 0);
+    astrncpy(req->name, params, sizeof(req->name));
+
+    __atomic_store_n(&pdata->spawnSerial, req->serial, __ATOMIC_RELEASE);
+    SpawnQueuePush(&g_spawnQueue, req);
+}
+
+/**
+ * Makes the player's queued spawn request stale and lets them launch again.
+ * Called when they change arena, ship or freq, since the request was checked against the old ones.
+ */
+local void CancelSpawnRequest(Player *p) {
+    HSFieldPlayerData *pdata = PPDATA(p, pdkey);
+    int expected = FieldPending;
+
+    __atomic_store_n(&pdata->spawnSerial, __atomic_add_fetch(&g_nextSpawnSerial, 1, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+    __atomic_compare_exchange_n(&pdata->fieldState, &expected, FieldNone, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/****************************/
+
+/**
+ * Starts the field loader thread.
+ */
+local void LoaderStart() {
+    LLInit(&g_loader.queue);
+    pthread_mutex_init(&g_loader.lock, NULL);
+    pthread_cond_init(&g_loader.cond, NULL);
+
+    g_loader.quit = 0;
+    g_loader.running = pthread_create(&g_loader.thread, NULL, LoaderMain, NULL) == 0;
+
+    if (!g_loader.running)
+        lm->Log(L_WARN, "<%s> Unable to start the field loader thread, fields will load on attach.", MODULE_NAME);
+}
+
+/**
+ * Stops the field loader thread. Every arena is detached by then, so the queue is empty.
+ */
+local void LoaderStop() {
+    if (g_loader.running) {
+        pthread_mutex_lock(&g_loader.lock);
+        g_loader.quit = 1;
+        pthread_cond_broadcast(&g_loader.cond);
+        pthread_mutex_unlock(&g_loader.lock);
+
+        pthread_join(g_loader.thread, NULL);
+        g_loader.running = 0;
+    }
+
+    LLEmpty(&g_loader.queue);
+    pthread_cond_destroy(&g_loader.cond);
+    pthread_mutex_destroy(&g_loader.lock);
+}
+
+/**
+ * Loads the arena's field types in the background, or right away if the loader thread isn't running.
+ */
+local void LoaderQueue(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+
+    __atomic_store_n(&adata->fieldsLoading, 1, __ATOMIC_RELEASE);
+
+    if (!g_loader.running) {
+        BuildArenaFields(arena);
+        return;
+    }
+
+    pthread_mutex_lock(&g_loader.lock);
+    LLAdd(&g_loader.queue, arena);
+    pthread_cond_broadcast(&g_loader.cond);
+    pthread_mutex_unlock(&g_loader.lock);
+}
+
+/**
+ * Drops the arena from the queue, or waits for its load to finish if it already started.
+ * The loader reads the arena's config, so this must be done before the arena goes away.
+ */
+local void LoaderCancel(Arena *arena) {
+    HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
+
+    if (!g_loader.running)
+        return;
+
+    pthread_mutex_lock(&g_loader.lock);
+    LLRemove(&g_loader.queue, arena);
+    while (g_loader.current == arena)
+        pthread_cond_wait(&g_loader.cond, &g_loader.lock);
+    pthread_mutex_unlock(&g_loader.lock);
+
+    __atomic_store_n(&adata->fieldsLoading, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits until every queued arena has been loaded. Used before the set of field classes changes,
+ * so no class loader is running and every field type is in a list the class changes reach.
+ */
+local void LoaderWaitIdle() {
+    if (!g_loader.running)
+        return;
+
+    pthread_mutex_lock(&g_loader.lock);
+    while (LLGetHead(&g_loader.queue) || g_loader.current)
+        pthread_cond_wait(&g_loader.cond, &g_loader.lock);
+    pthread_mutex_unlock(&g_loader.lock);
+}
+
+/**
+ * Field loader thread. Builds the field types of each queued arena.
+ */
+local void *LoaderMain(void *unused) {
+    pthread_mutex_lock(&g_loader.lock);
+    while (1) {
+        while (!LLGetHead(&g_loader.queue) && !g_loader.quit)
+            pthread_cond_wait(&g_loader.cond, &g_loader.lock);
+
+        if (g_loader.quit)
+            break;
+
+        g_loader.current = LLRemoveFirst(&g_loader.queue);
+        pthread_mutex_unlock(&g_loader.lock);
+
+        BuildArenaFields(g_loader.current);
+
+        pthread_mutex_lock(&g_loader.lock);
+        g_loader.current = NULL;
+        pthread_cond_broadcast(&g_loader.cond);
+    }
+    pthread_mutex_unlock(&g_loader.lock);
+
+    return NULL;
+}
+
+/****************************/
+
+local helptext_t reloadfields_help =
+"Targets: none\n"
+"Syntax:\n"
+"  ?reloadfields\n"
+"Reloads the field types from the arena config without reattaching the arena.\n"
+"Live fields keep running unless their type was removed or changed class.\n"
+"Classes that don't list their config keys keep their old properties.\n";
+local void Creloadfields(const char *cmd, const char *params, Player *p, const Target *target) {
+    HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
+    int added, changed, removed;
+    int loading = 0;
+
+    // Held for the whole reload, so the loader and other reloads stay out while it works without the mutex
+    if (!__atomic_compare_exchange_n(&adata->fieldsLoading, &loading, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        chat->SendMessage(p, "Field types are still loading.");
+        return;
+    }
+
+    ReloadFields(p->arena, &added, &changed, &removed);
+    __atomic_store_n(&adata->fieldsLoading, 0, __ATOMIC_RELEASE);
+
+    lm->LogA(L_INFO, MODULE_NAME, p->arena, "%s reloaded the field types: %d added, %d changed, %d removed.",
+        p->name, added, changed, removed);
+    chat->SendMessage(p, "Field types reloaded: %d added, %d changed, %d removed.", added, changed, removed);
+}
+
+local helptext_t fieldtrace_help =
+"Targets: none\n"
+"Syntax:\n"
+"  ?fieldtrace [on|off|dump]\n"
+"Starts or stops recording the field tick trace. dump writes the\n"
+"recorded events to the trace file in Chrome trace event format.\n";
+local void Cfieldtrace(const char *cmd, const char *params, Player *p, const Target *target) {
+    if (strcasecmp(params, "on") == 0) {
+        if (!g_traceClockStart) {
+            g_traceNsStart = MonotonicNs();
+            g_traceClockStart = TraceNow();
         }
+        g_tracing = 1;
+        chat->SendMessage(p, "Field tracing started.");
+    } else if (strcasecmp(params, "off") == 0) {
+        g_tracing = 0;
+        chat->SendMessage(p, "Field tracing stopped.");
+    } else if (strcasecmp(params, "dump") == 0) {
+        int count = TraceDump(g_traceFile);
+
+        if (count < 0)
+            chat->SendMessage(p, "Unable to write the field trace to %s.", g_traceFile);
+        else
+            chat->SendMessage(p, "Wrote %d trace events to %s.", count, g_traceFile);
+    } else {
+        chat->SendMessage(p, "Field tracing is %s (%d threads, %u events per thread).",
+            g_tracing ? "on" : "off", g_traceRingCount, g_traceRingSize);
     }
-    
-    if (type && type->fieldClass) {
-        if (items->getPropertySum(p, p->p_ship, "field", 0) & type->property) {
-            pdata->lastField = current_ticks();
-            BeginFieldInstance(p->arena, p, type);
-            chat->SendMessage(p, "%s field created.", type->name);
-            return;
-        } else {
-            if (*params)
-                chat->SendMessage(p, "You do not have that type of field available.");
-            else
-                chat->SendMessage(p, "You don't have any fields!");
+}
+
+local helptext_t fieldheatmap_help =
+"Targets: none\n"
+"Syntax:\n"
+"  ?fieldheatmap [launches|hits|reset]\n"
+"Writes where fields were launched, or where they acted on players, to a\n"
+"PGM image with one pixel per 16x16 tiles. reset clears both heatmaps.\n";
+local void Cfieldheatmap(const char *cmd, const char *params, Player *p, const Target *target) {
+    HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
+    const uint32_t *grid;
+    const char *kind;
+    char filename[512];
+
+    if (strcasecmp(params, "reset") == 0) {
+        for (int i = 0; i < HEAT_CELLS; i++) {
+            __atomic_store_n(&adata->heatLaunches[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&adata->heatHits[i], 0, __ATOMIC_RELAXED);
         }
+        chat->SendMessage(p, "Field heatmaps cleared.");
+        return;
+    }
+
+    if (strcasecmp(params, "hits") == 0) {
+        grid = adata->heatHits;
+        kind = "hits";
     } else {
-        if (type)
-            chat->SendMessage(p, "You don't have any fields!");
-        else
-            chat->SendMessage(p, "That type of field doesn't exist.");
+        grid = adata->heatLaunches;
+        kind = "launches";
     }
+
+    snprintf(filename, sizeof(filename), "%s-%s-%s.pgm", g_heatmapPrefix, p->arena->name, kind);
+
+    int total = HeatmapDump(grid, filename);
+    if (total < 0)
+        chat->SendMessage(p, "Unable to write the field heatmap to %s.", filename);
+    else
+        chat->SendMessage(p, "Wrote %d field %s to %s.", total, kind, filename);
+}
+
+local helptext_t fieldstats_help =
+"Targets: none\n"
+"Syntax:\n"
+"  ?fieldstats\n"
+"Shows the field counters for this arena since it was created.\n";
+local void Cfieldstats(const char *cmd, const char *params, Player *p, const Target *target) {
+    HSFieldArenaData *adata = P_ARENA_DATA(p->arena, adkey);
+    HSFieldCounters c;
+
+    CopyCounters(&c, adata->stats);
+
+    chat->SendMessage(p, "Fields: %d live, %d fake players, %llu spawned, %llu expired, %llu updates.",
+        adata->stats->live, adata->stats->fakes, (unsigned long long)c.stats[StatSpawns], (unsigned long long)c.stats[StatExpiries],
+        (unsigned long long)c.stats[StatUpdates]);
+    chat->SendMessage(p, "Update time: p50 %lluns, p90 %lluns, p99 %lluns.",
+        (unsigned long long)HistPercentile(c.updateNs, 500), (unsigned long long)HistPercentile(c.updateNs, 900),
+        (unsigned long long)HistPercentile(c.updateNs, 990));
+    chat->SendMessage(p, "Tick time: p50 %lluns, p99 %lluns. Updates deferred to a later tick: %llu.",
+        (unsigned long long)HistPercentile(c.tickNs, 500), (unsigned long long)HistPercentile(c.tickNs, 990),
+        (unsigned long long)c.stats[StatDeferredUpdates]);
+    chat->SendMessage(p, "Lateness: p50 %llu ticks, p99 %llu ticks. Backlog after the last tick: %d.",
+        (unsigned long long)HistPercentile(c.lateTicks, 500), (unsigned long long)HistPercentile(c.lateTicks, 990),
+        __atomic_load_n(&adata->stats->backlog, __ATOMIC_RELAXED));
+    chat->SendMessage(p, "Weapons: %llu packets (%llu bytes), %llu shots suppressed. Override resends: %llu. Prize grants: %llu.",
+        (unsigned long long)c.stats[StatWeaponPackets], (unsigned long long)c.stats[StatWeaponBytes],
+        (unsigned long long)c.stats[StatSuppressedShots],
+        (unsigned long long)c.stats[StatOverrideResends], (unsigned long long)c.stats[StatPrizeGrants]);
+    chat->SendMessage(p, "Moving fields: %llu LVZ moves sent.", (unsigned long long)c.stats[StatLVZMoves]);
+    chat->SendMessage(p, "Wall masks: %llu built (avg %lluns), %llu shared.",
+        (unsigned long long)c.stats[StatMaskBuilds],
+        (unsigned long long)(c.stats[StatMaskBuilds] ? c.stats[StatMaskBuildNs] / c.stats[StatMaskBuilds] : 0),
+        (unsigned long long)c.stats[StatMaskShares]);
+
+    if (g_metrics.dropped)
+        chat->SendMessage(p, "Metrics records dropped: %d.", g_metrics.dropped);
 }
 
 /*******************************/
@@ -708,8 +5291,11 @@ local int GetInterfaces(Imodman *mm_) {
         obj = mm->GetInterface(I_OBJECTS, ALLARENAS);
         fake = mm->GetInterface(I_FAKE, ALLARENAS);
         items = mm->GetInterface(I_HSCORE_ITEMS, ALLARENAS);
+        net = mm->GetInterface(I_NET, ALLARENAS);
+        game = mm->GetInterface(I_GAME, ALLARENAS);
+        mapdata = mm->GetInterface(I_MAPDATA, ALLARENAS);
 
-        return mm && chat && lm && cmd && pd && aman && ml && obj && fake && items;
+        return mm && chat && lm && cmd && pd && aman && ml && obj && fake && items && net && game && mapdata;
     }
 
     return 0;
@@ -730,6 +5316,9 @@ local void ReleaseInterfaces() {
         mm->ReleaseInterface(obj);
         mm->ReleaseInterface(fake);
         mm->ReleaseInterface(items);
+        mm->ReleaseInterface(net);
+        mm->ReleaseInterface(game);
+        mm->ReleaseInterface(mapdata);
 
         mm = NULL;
     }
@@ -773,9 +5362,68 @@ EXPORT int MM_hs_fields(int action, Imodman *mm_, Arena *arena) {
             }
 
             HashInit(&g_fieldClasses);
+            HashInit(&g_sharedProperties);
+            SpawnQueueInit(&g_spawnQueue);
+            LoaderStart();
+
+            StatsOpenSegment();
+
+            // The mainloop thread works on jobs too, so one thread per core beyond it.
+            int threads = cfg->GetInt(GLOBAL, "hs_fields", "UpdateThreads", 0);
+            if (threads <= 0)
+                threads = sysconf(_SC_NPROCESSORS_ONLN);
+            WorkerPoolStart(&g_pool, threads - 1);
+
+            int budgetUs = cfg->GetInt(GLOBAL, "hs_fields", "TickBudgetUs", 0);
+            g_tickBudgetNs = budgetUs > 0 ? (uint64_t)budgetUs * 1000 : 0;
+
+            ml->SetTimer(FieldEngineTick, 1, 1, NULL, NULL);
+
+            g_viewInterval = cfg->GetInt(GLOBAL, "hs_fields", "ViewUpdateInterval", 25);
+            if (g_viewInterval < 1)
+                g_viewInterval = 1;
+            ml->SetTimer(VisibilityTimer, g_viewInterval, g_viewInterval, NULL, NULL);
+
+            // Round up to a power of two, capped so the shift can't overflow
+            int traceEvents = cfg->GetInt(GLOBAL, "hs_fields", "TraceBufferEvents", 16384);
+            uint32_t traceSize = traceEvents > 1 << 24 ? 1 << 24 : traceEvents > 0 ? (uint32_t)traceEvents : 1;
+
+            g_traceRingSize = 1;
+            while (g_traceRingSize < traceSize)
+                g_traceRingSize <<= 1;
+
+            const char *traceFile = cfg->GetStr(GLOBAL, "hs_fields", "TraceFile");
+            astrncpy(g_traceFile, traceFile ? traceFile : "hs_fields_trace.json", sizeof(g_traceFile));
+
+            const char *heatmapPrefix = cfg->GetStr(GLOBAL, "hs_fields", "HeatmapPrefix");
+            astrncpy(g_heatmapPrefix, heatmapPrefix ? heatmapPrefix : "hs_fields_heat", sizeof(g_heatmapPrefix));
 
             mm->RegInterface(&fields_interface, ALLARENAS);
 
+            cmd->AddCommand("fieldtrace", Cfieldtrace, ALLARENAS, fieldtrace_help);
+
+            const char *metricsFile = cfg->GetStr(GLOBAL, "hs_fields", "MetricsFile");
+            g_metrics.interval = cfg->GetInt(GLOBAL, "hs_fields", "MetricsInterval", 60);
+            g_metrics.maxBytes = cfg->GetInt(GLOBAL, "hs_fields", "MetricsMaxBytes", 10 * 1024 * 1024);
+            g_metrics.maxFiles = cfg->GetInt(GLOBAL, "hs_fields", "MetricsFiles", 5);
+
+            if (metricsFile && *metricsFile && g_metrics.interval > 0) {
+                astrncpy(g_metrics.file, metricsFile, sizeof(g_metrics.file));
+                g_metrics.front = amalloc(METRICS_BUFFER_SIZE);
+                g_metrics.back = amalloc(METRICS_BUFFER_SIZE);
+                pthread_mutex_init(&g_metrics.lock, NULL);
+                pthread_cond_init(&g_metrics.cond, NULL);
+
+                if (pthread_create(&g_metrics.thread, NULL, MetricsThread, NULL) == 0) {
+                    ml->SetTimer(MetricsTimer, g_metrics.interval * 100, g_metrics.interval * 100, NULL, NULL);
+                } else {
+                    lm->Log(L_ERROR, "<%s> Unable to start the metrics writer thread.", MODULE_NAME);
+                    g_metrics.interval = 0;
+                }
+            } else {
+                g_metrics.interval = 0;
+            }
+
             rv = MM_OK;
 
         break;
@@ -784,21 +5432,33 @@ EXPORT int MM_hs_fields(int action, Imodman *mm_, Arena *arena) {
             HSFieldArenaData *adata = P_ARENA_DATA(arena, adkey);
 
             LLInit(&adata->fields);
-            LLInit(&adata->instances);
+            memset(&adata->store, 0, sizeof(adata->store));
+            adata->wheel = amalloc(sizeof(HSTimerWheel));
+            WheelInit(adata->wheel, current_ticks());
+            // Too big for the arena data, which asss limits to General:PerArenaBytes
+            adata->heatLaunches = amalloc(HEAT_CELLS * sizeof(uint32_t));
+            adata->heatHits = amalloc(HEAT_CELLS * sizeof(uint32_t));
+            HashInit(&adata->masks);
 
-            for (int i = 0; i < 8; i++) {
-                adata->cfgShipRadius[i] = cfg->GetInt(arena->cfg, cfg->SHIP_NAMES[i], "radius", 14);
-                if (!adata->cfgShipRadius[i])
-                    adata->cfgShipRadius[i] = 14;
-            }
+            StatsAttachArena(arena);
+            memset(&adata->lastMetrics, 0, sizeof(adata->lastMetrics));
 
-            LoadFields(arena);
+            LoadArenaConfig(arena);
+            LoaderQueue(arena);
+            FreqListsInit(arena);
 
             mm->RegCallback(CB_SHIPFREQCHANGE, OnShipFreqChange, arena);
             mm->RegCallback(CB_PLAYERACTION, OnPlayerAction, arena);
             mm->RegCallback(CB_KILL, OnPlayerKill, arena);
+            mm->RegCallback(CB_ARENAACTION, OnArenaAction, arena);
+            mm->RegCallback(CB_SPAWN, OnPlayerSpawn, arena);
 
             cmd->AddCommand("field", Cfield, arena, field_help);
+            cmd->AddCommand("fieldstats", Cfieldstats, arena, fieldstats_help);
+            cmd->AddCommand("reloadfields", Creloadfields, arena, reloadfields_help);
+            cmd->AddCommand("fieldheatmap", Cfieldheatmap, arena, fieldheatmap_help);
+
+            adata->attached = 1;
 
             rv = MM_OK;
         }
@@ -810,15 +5470,68 @@ EXPORT int MM_hs_fields(int action, Imodman *mm_, Arena *arena) {
             mm->UnregCallback(CB_SHIPFREQCHANGE, OnShipFreqChange, arena);
             mm->UnregCallback(CB_PLAYERACTION, OnPlayerAction, arena);
             mm->UnregCallback(CB_KILL, OnPlayerKill, arena);
+            mm->UnregCallback(CB_ARENAACTION, OnArenaAction, arena);
+            mm->UnregCallback(CB_SPAWN, OnPlayerSpawn, arena);
 
             cmd->RemoveCommand("field", Cfield, arena);
+            cmd->RemoveCommand("fieldstats", Cfieldstats, arena);
+            cmd->RemoveCommand("reloadfields", Creloadfields, arena);
+            cmd->RemoveCommand("fieldheatmap", Cfieldheatmap, arena);
+
+            adata->attached = 0;
 
-            HSFieldInstanceIterate(&adata->instances, RemoveAllInstancesFromPlayer, 0);
+            LoaderCancel(arena);
+
+            HSFieldInstanceIterate(&adata->store, RemoveAllInstancesFromPlayer, 0);
             HSFieldIterate(&adata->fields, UnloadFields, arena);
 
-            LLEmpty(&adata->instances);
+            // The destructors need the arena, so they run now. Readers may still be looking at the instances,
+            // so the store and the wall masks are freed once they leave.
+            EpochDrain(arena, NULL);
+
+            HSFieldStore *store = amalloc(sizeof(HSFieldStore));
+            *store = adata->store;
+            memset(&adata->store, 0, sizeof(adata->store));
+            EpochRetire(ReclaimStore, store, NULL);
+            HashEnum(&adata->masks, RetireMask, NULL);
+
+            afree(adata->wheel);
+            adata->wheel = NULL;
+            afree(adata->heatLaunches);
+            afree(adata->heatHits);
+            adata->heatLaunches = adata->heatHits = NULL;
+            HashDeinit(&adata->masks);
             LLEmpty(&adata->fields);
 
+            FreqListsClear(arena);
+
+            afree(adata->snapshot.x);
+            afree(adata->snapshot.y);
+            afree(adata->snapshot.radius);
+            afree(adata->snapshot.pid);
+            afree(adata->snapshot.freq);
+            afree(adata->snapshot.ship);
+            afree(adata->snapshot.rotation);
+            afree(adata->snapshot.xspeed);
+            afree(adata->snapshot.yspeed);
+            afree(adata->snapshot.energy);
+            afree(adata->snapshot.players);
+            afree(adata->snapshot.freqs);
+            afree(adata->sortedFreqs);
+            adata->sortedFreqs = NULL;
+            adata->sortedFreqsSize = adata->freqsSize = 0;
+            afree(adata->due);
+            afree(adata->expired);
+            afree(adata->effects.effects);
+            afree(adata->effects.players);
+            memset(&adata->snapshot, 0, sizeof(adata->snapshot));
+            memset(&adata->effects, 0, sizeof(adata->effects));
+            adata->snapshotSize = adata->dueCount = adata->dueSize = adata->expiredCount = adata->expiredSize = 0;
+            adata->due = NULL;
+            adata->expired = NULL;
+
+            StatsDetachArena(arena);
+
             rv = MM_OK;
         }
         break;
@@ -828,7 +5541,57 @@ EXPORT int MM_hs_fields(int action, Imodman *mm_, Arena *arena) {
                 break;
             }
 
+            cmd->RemoveCommand("fieldtrace", Cfieldtrace, ALLARENAS);
+
+            if (g_metrics.front) {
+                if (g_metrics.interval) {
+                    ml->ClearTimer(MetricsTimer, NULL);
+
+                    pthread_mutex_lock(&g_metrics.lock);
+                    g_metrics.quit = 1;
+                    pthread_cond_signal(&g_metrics.cond);
+                    pthread_mutex_unlock(&g_metrics.lock);
+
+                    pthread_join(g_metrics.thread, NULL);
+                }
+
+                pthread_cond_destroy(&g_metrics.cond);
+                pthread_mutex_destroy(&g_metrics.lock);
+                afree(g_metrics.front);
+                afree(g_metrics.back);
+                g_metrics.front = g_metrics.back = NULL;
+            }
+
+            g_tracing = 0;
+            for (int i = 0; i < g_traceRingCount; i++)
+                afree(g_traceRings[i]);
+            g_traceRingCount = 0;
+
             HashDeinit(&g_fieldClasses);
+            HashDeinit(&g_sharedProperties);
+
+            ml->ClearTimer(FieldEngineTick, NULL);
+            ml->ClearTimer(VisibilityTimer, NULL);
+            WorkerPoolStop(&g_pool);
+            LoaderStop();
+
+            // Commands are gone, so nothing else can be queued
+            for (HSSpawnRequest *req; (req = SpawnQueuePop(&g_spawnQueue)); )
+                afree(req);
+            afree(g_jobs);
+            g_jobs = NULL;
+            g_jobsSize = 0;
+            afree(g_arenas);
+            g_arenas = NULL;
+            g_arenasSize = 0;
+
+            EpochReclaimAll();
+            afree(g_retired);
+            afree(g_reclaiming);
+            g_retired = g_reclaiming = NULL;
+            g_retiredCount = g_retiredSize = g_reclaimingSize = 0;
+
+            StatsCloseSegment();
 
             aman->FreeArenaData(adkey);
             pd->FreePlayerData(pdkey);
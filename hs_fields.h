@@ -1,6 +1,9 @@
 #ifndef HS_FIELDS_H_
 #define HS_FIELDS_H_
 
+#include <stdint.h>
+#include "hs_fields_stats.h"
+
 enum Corners {
     UpperLeft = 0,
     UpperRight,
@@ -10,15 +13,105 @@ enum Corners {
     CornerCount
 };
 
+/**
+ * The area a field covers. Set with the "shape" key of the field type.
+ */
+enum HSFieldShape {
+    ShapeSquare = 0,
+    ShapeCircle,
+    ShapeRect,
+    ShapeRing,
+    ShapeCone,
+
+    ShapeCount
+};
+
+/**
+ * How a field moves once it's launched. Set with the "motion" key of the field type.
+ */
+enum HSFieldMotion {
+    MotionFixed = 0,
+    MotionFollow,
+    MotionDrift,
+
+    MotionCount
+};
+
+/**
+ * The kinds of events recorded by the tick trace.
+ */
+enum HSTraceKind {
+    TraceBegin = 0,
+    TraceUpdate,
+    TraceEnd,
+    TraceFireWeapon,
+    TraceOverrideResend,
+
+    TraceKindCount
+};
+
 struct HSField;
 struct HSFieldInstance;
 
+/**
+ * Links a field instance into its arena's expiry timer wheel. Private to hs_fields.
+ */
+typedef struct HSFieldTimer {
+    struct HSFieldTimer *prev;
+    struct HSFieldTimer *next;
+    ticks_t expires;
+} HSFieldTimer;
+
+/**
+ * Names a field instance within its arena. A handle outlives its instance: once the instance ends,
+ * Ihsfields.GetInstance returns NULL for it, even after a new instance takes its place in the store.
+ */
+typedef uint32_t HSFieldHandle;
+
+/**
+ * The map tiles around a field instance that can see its center. Walls block the field, so ships centered on
+ * the other tiles are never in it. Built once at launch and shared by the instances launched from the same tile.
+ */
+typedef struct HSFieldMask {
+    /**
+     * The tile at the mask's upper left corner.
+     */
+    short left;
+    short top;
+    
+    /**
+     * The size of the mask in tiles.
+     */
+    short width;
+    short height;
+    
+    /**
+     * One bit per tile, row major. Set for the tiles that can see the center.
+     */
+    uint32_t *bits;
+} HSFieldMask;
+
+/**
+ * A function run on the mainloop after field updates finish. See Ihsfields.Defer.
+ */
+typedef void(*HSFieldDeferFunc)(Arena *arena, Player *p, void *param);
+
 typedef void(*HSFieldLoader)(Arena *arena, const char *section, HashTable *properties);
 typedef void(*HSFieldCleanup)(Arena *arena, HashTable *properties);
 typedef void(*HSFieldInstanceConstructor)(struct HSFieldInstance *inst);
 typedef void(*HSFieldInstanceUpdate)(struct HSFieldInstance *inst);
 typedef void(*HSFieldInstanceDestructor)(struct HSFieldInstance *inst);
 
+/**
+ * Containment test for one shape. Picked when the field type loads.
+ * @param inst          The field instance.
+ * @param shipRadius    The radius of the ship being tested.
+ * @param dx            The ship's x position relative to the field instance.
+ * @param dy            The ship's y position relative to the field instance.
+ * @return              Non-zero if the ship touches the field.
+ */
+typedef int(*HSFieldContains)(const struct HSFieldInstance *inst, int shipRadius, int dx, int dy);
+
 /**
  * Structure of functions for each field class.
  */
@@ -30,6 +123,7 @@ typedef struct HSFieldClass {
     
     /**
      * Used when the field class is unloaded to cleanup anything.
+     * Runs on the mainloop once no field type or reader uses the properties, so the arena may be gone by then.
      */
     HSFieldCleanup cleanup;
     
@@ -44,9 +138,17 @@ typedef struct HSFieldClass {
     HSFieldInstanceUpdate update;
     
     /**
-     * Called when the field instance is destroyed.
+     * Called on the mainloop after the field instance ended, once no reader can still see it.
+     * If the arena detaches or the class is unregistered first, it is called then instead.
      */
     HSFieldInstanceDestructor destructor;
+    
+    /**
+     * The config keys the loader reads, ending with NULL. Field types in any arena whose keys have the same values
+     * share one set of properties, loaded once. ?reloadfields only loads new properties when one of them changed.
+     * Leave NULL to give every field type its own properties.
+     */
+    const char * const *keys;
 } HSFieldClass;
 
 /**
@@ -62,6 +164,11 @@ typedef struct HSField {
      */
     char name[32];
     
+    /**
+     * The config section the field type was loaded from.
+     */
+    char section[64];
+    
     /**
      * The field classname of this field type.
      */
@@ -97,6 +204,48 @@ typedef struct HSField {
      */
     short radius;
     
+    /**
+     * One of HSFieldShape.
+     */
+    i8 shape;
+    
+    /**
+     * Half the width and height of the field's bounding box. Set for every shape, used to place the corner LVZ.
+     */
+    short halfWidth;
+    short halfHeight;
+    
+    /**
+     * The radius of the hole in a ring.
+     */
+    short innerRadius;
+    
+    /**
+     * Cosine of half the cone's angle, scaled by 1024.
+     */
+    short coneCos;
+    
+    /**
+     * The containment test for the shape.
+     */
+    HSFieldContains contains;
+    
+    /**
+     * Non-zero if walls block the field. Only fixed fields are blocked, since the mask is built where the field launches.
+     */
+    i8 occlude;
+    
+    /**
+     * One of HSFieldMotion.
+     */
+    i8 motion;
+    
+    /**
+     * The velocity of a drifting field, in pixels per 10 seconds like ship speeds.
+     */
+    short velocityX;
+    short velocityY;
+    
     /**
      * The base object ID for each corner of the field.
      */
@@ -118,9 +267,10 @@ typedef struct HSField {
     i8 LVZSize;
     
     /**
-     * Any properties for the specific field class.
+     * Any properties for the specific field class. May be shared with field types in other arenas,
+     * so they must not change after the loader returns.
      */
-    HashTable properties;
+    HashTable *properties;
 } HSField;
 
 /**
@@ -145,18 +295,33 @@ typedef struct HSFieldInstance {
      */
     HSField *type;
     
+    /**
+     * A number identifying the field instance in traces.
+     */
+    uint32_t id;
+    
+    /**
+     * The field instance's handle. See Ihsfields.GetInstance.
+     */
+    HSFieldHandle handle;
+    
     /**
      * When the field instance will be destroyed.
      */
     ticks_t endTime;
     
+    /**
+     * Fires at endTime to destroy the field instance.
+     */
+    HSFieldTimer expiry;
+    
     /**
      * The object ID for each corner of the field instance.
      */
     short LVZIds[CornerCount];
     
     /**
-     * The x position of the field instance.
+     * The x position of the field instance. Moving fields are moved each tick before the updates run.
      */
     short x;
     
@@ -165,6 +330,34 @@ typedef struct HSFieldInstance {
      */
     short y;
     
+    /**
+     * The freq of the player that created the field instance.
+     */
+    short freq;
+    
+    /**
+     * The direction the owner was facing when the field was created, as a unit vector scaled by 1024.
+     * Cones point this way.
+     */
+    short dirX;
+    short dirY;
+    
+    /**
+     * The tiles the field reaches past walls, or NULL if walls don't block it.
+     */
+    const HSFieldMask *mask;
+    
+    /**
+     * The players that have been sent the field's LVZ. Only used on the mainloop.
+     */
+    LinkedList viewers;
+    
+    /**
+     * A bit for each pid in viewers, so checking for a viewer doesn't walk the list. Only used on the mainloop.
+     */
+    uint32_t *viewerBits;
+    int viewerWords;
+    
     /**
      * Data stored per field instance.
      * Needs to be manually allocated in the constructor.
@@ -172,12 +365,115 @@ typedef struct HSFieldInstance {
     HashTable *data;
 } HSFieldInstance;
 
+/**
+ * The players of one freq in the snapshot. They are snapshot players first to first + count - 1.
+ */
+typedef struct HSFieldSnapshotFreq {
+    int freq;
+    int first;
+    int count;
+} HSFieldSnapshotFreq;
+
+/**
+ * The players in an arena that are in a ship and alive, captured once per tick before any field updates run.
+ * Players are grouped by freq, with the groups in order of freq.
+ *
+ * Each value is its own array indexed by player, so a scan over positions only touches position data.
+ */
+typedef struct HSFieldSnapshot {
+    /**
+     * The tick the snapshot was taken on.
+     */
+    ticks_t tick;
+    
+    /**
+     * The number of players in the snapshot.
+     */
+    int count;
+    
+    /**
+     * Read for every player by the containment tests.
+     */
+    int16_t *x;
+    int16_t *y;
+    int16_t *radius;
+    
+    /**
+     * Read for the players a field acts on.
+     */
+    int16_t *pid;
+    int16_t *freq;
+    int8_t *ship;
+    int8_t *rotation;
+    int16_t *xspeed;
+    int16_t *yspeed;
+    int16_t *energy;
+    
+    /**
+     * The players. Only use them for sending, read everything else from the snapshot.
+     */
+    Player **players;
+    
+    /**
+     * The freq groups.
+     */
+    int freqCount;
+    HSFieldSnapshotFreq *freqs;
+} HSFieldSnapshot;
+
 int InSquare(Arena *arena, int ship, int sx, int sy, int r, int x, int y);
 
+/**
+ * Checks if a ship touches a field instance, using the shape of the instance's field type and its wall mask.
+ */
+int InField(const HSFieldInstance *inst, int ship, int x, int y);
+
+/**
+ * Checks if a ship centered at pixel x, y is on a tile of the mask that can see the field's center.
+ */
+#define HS_IN_MASK(mask, x, y) \
+    ((unsigned)(((x) >> 4) - (mask)->left) < (unsigned)(mask)->width && \
+     (unsigned)(((y) >> 4) - (mask)->top) < (unsigned)(mask)->height && \
+     HS_MASK_BIT((mask), (((y) >> 4) - (mask)->top) * (mask)->width + ((x) >> 4) - (mask)->left))
+#define HS_MASK_BIT(mask, n) (((mask)->bits[(n) >> 5] >> ((n) & 31)) & 1)
+
+/**
+ * Checks if snapshot player i touches a field instance, and no wall is in the way.
+ */
+#define HS_IN_FIELD(inst, snap, i) \
+    ((inst)->type->contains((inst), (snap)->radius[i], (snap)->x[i] - (inst)->x, (snap)->y[i] - (inst)->y) && \
+     (!(inst)->mask || HS_IN_MASK((inst)->mask, (snap)->x[i], (snap)->y[i])))
+
 #define HS_IS_SPEC(p) ((p->p_ship == SHIP_SPEC))
 #define HS_IS_ON_FREQ(p,a,f) ((p->arena == a) && (p->p_freq == f))
 
-#define I_HSFIELDS "hs_fields-1"
+#define HS_FIELD_MAX_PACKET 64
+
+/**
+ * Loops i over the indexes of the snapshot players on freq f.
+ * This is two nested loops, so break only leaves the current freq.
+ */
+#define HS_FOR_SAME_FREQ(snap, f, i) \
+    for (int hs_g_ = 0; hs_g_ < (snap)->freqCount; hs_g_++) \
+        if ((snap)->freqs[hs_g_].freq == (f)) \
+            for (int i = (snap)->freqs[hs_g_].first; i < (snap)->freqs[hs_g_].first + (snap)->freqs[hs_g_].count; i++)
+
+/**
+ * Loops i over the indexes of the snapshot players on every freq but f.
+ * This is two nested loops, so break only leaves the current freq.
+ */
+#define HS_FOR_ENEMY_FREQ(snap, f, i) \
+    for (int hs_g_ = 0; hs_g_ < (snap)->freqCount; hs_g_++) \
+        if ((snap)->freqs[hs_g_].freq != (f)) \
+            for (int i = (snap)->freqs[hs_g_].first; i < (snap)->freqs[hs_g_].first + (snap)->freqs[hs_g_].count; i++)
+
+/**
+ * Records an instant trace event for a field instance. Only a load and a branch when tracing is off.
+ */
+#define HS_FIELD_TRACE(f, inst, kind, arg, value) \
+    do { if (*(f)->tracing) (f)->TraceEvent((inst), (kind), (arg), (value)); } while (0)
+
+#define I_HSFIELDS "hs_fields-18"
 typedef struct Ihsfields {
     INTERFACE_HEAD_DECL
 
@@ -194,6 +490,96 @@ typedef struct Ihsfields {
      * @param className     The name of the field class to be unregistered.
      */
     void(*UnregisterFieldClass)(const char *className);
+    
+    /**
+     * Non-zero while the tick trace is recording. Use HS_FIELD_TRACE instead of reading this directly.
+     */
+    volatile int *tracing;
+    
+    /**
+     * Records an instant event in the calling thread's trace buffer.
+     * @param inst      The field instance the event belongs to.
+     * @param kind      One of the HSTraceKind values.
+     * @param arg       Event specific argument, such as the pid of the target player.
+     * @param value     Event specific value, such as the amount of bytes sent.
+     */
+    void(*TraceEvent)(HSFieldInstance *inst, int kind, int arg, int value);
+    
+    /**
+     * Adds to one of the arena's field counters. Safe to call from any thread.
+     * @param arena     The arena the counter belongs to.
+     * @param stat      One of the HSFieldStat values from hs_fields_stats.h.
+     * @param amount    The amount to add.
+     */
+    void(*AddStat)(Arena *arena, int stat, int amount);
+    
+    /**
+     * Field class updates run on worker threads, one arena per job. They must read players from this snapshot
+     * and send everything through SendToOne, GivePrize and Defer, which queue the work for the mainloop.
+     * The queues are drained in arena order after all the updates finish.
+     * Field instances can't start or end while updates run, so an update must not wait on a thread that does that.
+     * Outside of an update these functions act right away.
+     * @param arena     The arena of the field instance being updated.
+     * @return          The player snapshot for the current tick.
+     */
+    const HSFieldSnapshot *(*GetSnapshot)(Arena *arena);
+    
+    /**
+     * Queues a packet for a player.
+     * @param inst      The field instance sending the packet.
+     * @param p         The player to send to.
+     * @param data      The packet. At most HS_FIELD_MAX_PACKET bytes.
+     * @param len       The length of the packet.
+     * @param flags     The net flags to send with.
+     */
+    void(*SendToOne)(HSFieldInstance *inst, Player *p, byte *data, int len, int flags);
+    
+    /**
+     * Queues a prize. Supports T_PLAYER and T_LIST targets.
+     * @param inst      The field instance giving the prize.
+     * @param target    The players to prize.
+     * @param prize     The prize number.
+     * @param count     The number of prizes.
+     */
+    void(*GivePrize)(HSFieldInstance *inst, const Target *target, int prize, int count);
+    
+    /**
+     * Queues a function to run on the mainloop. Skipped if the player has left the arena by then.
+     * @param inst      The field instance queueing the function.
+     * @param func      The function to run.
+     * @param p         The player passed to the function.
+     * @param param     Passed to the function. Must stay valid until the end of the tick.
+     */
+    void(*Defer)(HSFieldInstance *inst, HSFieldDeferFunc func, Player *p, void *param);
+    
+    /**
+     * Finds a field instance by its handle without taking any locks. Call it between BeginRead and EndRead:
+     * the instance stays allocated until EndRead, though it may end in the meantime. Field updates already run in a read section.
+     * @param arena     The arena of the field instance.
+     * @param handle    The handle of the field instance.
+     * @return          The field instance, or NULL if it has ended.
+     */
+    HSFieldInstance *(*GetInstance)(Arena *arena, HSFieldHandle handle);
+    
+    /**
+     * Starts a read section on the calling thread. Field instances and types that end or unload during it are only freed
+     * after EndRead. Read sections nest and don't block each other or the engine.
+     */
+    void(*BeginRead)(void);
+    
+    /**
+     * Ends the calling thread's read section.
+     */
+    void(*EndRead)(void);
+    
+    /**
+     * Counts a field acting on a player at a map position in the arena's hit heatmap.
+     * Only does an atomic add, so it's safe to call from any thread.
+     * @param inst      The field instance that hit the player.
+     * @param x         The player's x position in pixels.
+     * @param y         The player's y position in pixels.
+     */
+    void(*RecordHit)(HSFieldInstance *inst, int x, int y);
 } Ihsfields;
 
 #endif
@@ -1,3 +1,9 @@
 hs_fields_mods = hs_fields hs_attackfields
+hs_fields_libs = -lrt
 
 $(eval $(call dl_template,hs_fields))
+
+# Standalone reader for the shared memory stats segment.
+hs_fields_dir := $(dir $(lastword $(MAKEFILE_LIST)))
+hs_fieldmon: $(hs_fields_dir)hs_fieldmon.c $(hs_fields_dir)hs_fields_stats.h
+	$(CC) -O2 -o $@ $< -lrt
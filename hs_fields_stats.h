@@ -0,0 +1,162 @@
+#ifndef HS_FIELDS_STATS_H_
+#define HS_FIELDS_STATS_H_
+
+#include <stdint.h>
+
+/**
+ * Layout of the shared memory segment hs_fields publishes its counters in.
+ * This header only uses fixed width types so external monitors can include it without asss.
+ *
+ * Counters are only ever increased, so readers can load them at any time and compute rates from deltas.
+ * The seq fields are seqlocks around the parts that change shape: a reader copies the data,
+ * and retries if seq was odd or changed while copying.
+ */
+
+#define HS_STATS_SHM_NAME       "/hs_fields_stats"
+#define HS_STATS_MAGIC          0x53464648 // "HFFS"
+#define HS_STATS_VERSION        3
+
+#define HS_STATS_MAX_ARENAS     64
+#define HS_STATS_MAX_CLASSES    16
+#define HS_STATS_COUNTERS       16
+#define HS_STATS_HIST_BUCKETS   160
+
+/**
+ * Counters kept per arena. Indexes into HSStatsArena.stats.
+ */
+enum HSFieldStat {
+    StatSpawns = 0,
+    StatExpiries,
+    StatUpdates,
+    StatWeaponPackets,
+    StatWeaponBytes,
+    StatOverrideResends,
+    StatPrizeGrants,
+    StatSuppressedShots,
+    StatDeferredUpdates,
+    StatLVZMoves,
+    StatMaskBuilds,
+    StatMaskShares,
+    StatMaskBuildNs,
+
+    StatCount
+};
+
+/**
+ * Counters for one arena.
+ */
+typedef struct HSStatsArena {
+    /**
+     * Seqlock around name and inUse.
+     */
+    uint32_t seq;
+
+    /**
+     * Non-zero while the slot belongs to an arena.
+     */
+    uint32_t inUse;
+
+    /**
+     * The name of the arena.
+     */
+    char name[24];
+
+    /**
+     * The number of live field instances.
+     */
+    int32_t live;
+
+    /**
+     * The number of fake players used by field instances.
+     */
+    int32_t fakes;
+
+    /**
+     * The number of due updates the last tick left for later because the tick budget ran out.
+     */
+    int32_t backlog;
+
+    /**
+     * One counter for each HSFieldStat.
+     */
+    uint64_t stats[HS_STATS_COUNTERS];
+
+    /**
+     * Log-linear histogram of class update times in nanoseconds.
+     * Values below 4 have their own bucket, every power of two above that is split into four buckets.
+     */
+    uint32_t updateNs[HS_STATS_HIST_BUCKETS];
+
+    /**
+     * Histogram of the time each engine tick spent updating the arena's instances, bucketed like updateNs.
+     */
+    uint32_t tickNs[HS_STATS_HIST_BUCKETS];
+
+    /**
+     * Histogram of how many ticks after its deadline each update ran, bucketed like updateNs.
+     */
+    uint32_t lateTicks[HS_STATS_HIST_BUCKETS];
+} HSStatsArena;
+
+/**
+ * Counters for one field class, summed over all arenas.
+ */
+typedef struct HSStatsClass {
+    /**
+     * Non-zero once the slot has been given to a class. Slots are never reused for another name.
+     */
+    uint32_t inUse;
+
+    /**
+     * The name of the field class.
+     */
+    char name[32];
+
+    /**
+     * The number of class updates.
+     */
+    uint64_t updates;
+
+    /**
+     * The total nanoseconds spent in class updates.
+     */
+    uint64_t updateNs;
+} HSStatsClass;
+
+/**
+ * The whole segment.
+ */
+typedef struct HSStatsSegment {
+    uint32_t magic;
+    uint32_t version;
+
+    /**
+     * Seqlock around class slot assignment.
+     */
+    uint32_t seq;
+
+    /**
+     * sizeof(HSStatsSegment) of the writer.
+     */
+    uint32_t size;
+
+    /**
+     * Unix time when the segment was created. Changes when the module is reloaded.
+     */
+    uint64_t created;
+
+    /**
+     * The number of allocated field instances.
+     */
+    int32_t instancesUsed;
+
+    /**
+     * The highest instancesUsed has been.
+     */
+    int32_t instancesPeak;
+
+    HSStatsClass classes[HS_STATS_MAX_CLASSES];
+    HSStatsArena arenas[HS_STATS_MAX_ARENAS];
+} HSStatsSegment;
+
+#endif
@@ -78,6 +78,10 @@ local void OverrideInstanceConstructor(HSFieldInstance *inst) {
     inst->data = HashAlloc();
 }
 
+/**
+ * Adds an instance's overrides to the player. Every instance that applies an override adds its own entry,
+ * so the override stays until the last of them removes it.
+ */
 local void AddOverrides(Player *p, LinkedList *overrides) {
     OverridePlayerData *pdata = PPDATA(p, pdkey);
     
@@ -88,10 +92,13 @@ local void AddOverrides(Player *p, LinkedList *overrides) {
     OverrideData *data;
     
     FOR_EACH(overrides, data, link) {
-        HashReplace(pdata->overrides, data->name, data);
+        HashAdd(pdata->overrides, data->name, data);
     }
 }
 
+/**
+ * Removes one instance's entries for its overrides from the player.
+ */
 local void RemoveOverrides(Player *p, LinkedList *overrides) {
     OverridePlayerData *pdata = PPDATA(p, pdkey);
     
@@ -106,28 +113,40 @@ local void RemoveOverrides(Player *p, LinkedList *overrides) {
     }
 }
 
+/**
+ * Deferred from the update. Adds the field's overrides to the player and resends their ship settings.
+ */
+local void ApplyOverrides(Arena *arena, Player *p, void *overrides) {
+    OverrideArenaData *adata = P_ARENA_DATA(arena, adkey);
+    
+    AddOverrides(p, (LinkedList *)overrides);
+    adata->spawner->resendOverrides(p);
+}
+
+/**
+ * Deferred from the update. Removes the field's overrides from the player and resends their ship settings.
+ */
+local void ClearOverrides(Arena *arena, Player *p, void *overrides) {
+    OverrideArenaData *adata = P_ARENA_DATA(arena, adkey);
+    
+    RemoveOverrides(p, (LinkedList *)overrides);
+    adata->spawner->resendOverrides(p);
+}
+
 /**
  * Called when a field instance gets updated.
  */
 local void OverrideInstanceUpdate(HSFieldInstance *inst) {
-    Player *p;
-    Link *link;
+    const HSFieldSnapshot *snap = fields->GetSnapshot(inst->arena);
+    OverrideArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
+    
+    if (!adata->spawner) return;
 
-    pd->Lock();
-    FOR_EACH_PLAYER_IN_ARENA(p, inst->arena) {
-        if (HS_IS_SPEC(p))
-            continue;
-        if (!HS_IS_ON_FREQ(p, inst->arena, inst->player->pkt.freq))
-            continue;
-        if (p->flags.is_dead)
-            continue;
-        
-        OverrideArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
-        
-        if (!adata->spawner) continue;
+    HS_FOR_SAME_FREQ(snap, inst->freq, i) {
+        Player *p = snap->players[i];
         
         // Update if they are inside the field
-        if (InSquare(p->arena, p->p_ship, inst->x, inst->y, inst->type->radius, p->position.x, p->position.y)) {
+        if (HS_IN_FIELD(inst, snap, i)) {
             InstancePlayerData *ipdata = HashGetOne(inst->data, p->name);
             
             if (!ipdata) {
@@ -136,11 +155,12 @@ local void OverrideInstanceUpdate(HSFieldInstance *inst) {
             
                 ipdata->end_time = current_ticks() + 100;
                 
-                LinkedList *overrides = HashGetOne(&inst->type->properties, "overrides");
+                LinkedList *overrides = HashGetOne(inst->type->properties, "overrides");
                 
-                AddOverrides(p, overrides);
-                
-                adata->spawner->resendOverrides(p);
+                fields->Defer(inst, ApplyOverrides, p, overrides);
+                HS_FIELD_TRACE(fields, inst, TraceOverrideResend, p->pid, 1);
+                fields->AddStat(inst->arena, StatOverrideResends, 1);
+                fields->RecordHit(inst, snap->x[i], snap->y[i]);
             }
             
             ipdata->end_time = current_ticks() + 100;
@@ -149,16 +169,16 @@ local void OverrideInstanceUpdate(HSFieldInstance *inst) {
         InstancePlayerData *ipdata = HashGetOne(inst->data, p->name);
         
         if (ipdata && current_ticks() >= ipdata->end_time) {
-            LinkedList *overrides = HashGetOne(&inst->type->properties, "overrides");
+            LinkedList *overrides = HashGetOne(inst->type->properties, "overrides");
             
-            RemoveOverrides(p, overrides);
-            adata->spawner->resendOverrides(p);
+            fields->Defer(inst, ClearOverrides, p, overrides);
+            HS_FIELD_TRACE(fields, inst, TraceOverrideResend, p->pid, 0);
+            fields->AddStat(inst->arena, StatOverrideResends, 1);
             
             HashRemove(inst->data, p->name, ipdata);
             afree(ipdata);
         }
     }
-    pd->Unlock();
 }
 
 /**
@@ -169,21 +189,20 @@ void OverrideInstanceDestructor(HSFieldInstance *inst) {
     Link *link;
     pd->Lock();
     FOR_EACH_PLAYER_IN_ARENA(p, inst->arena) {
-        if (HS_IS_SPEC(p))
-            continue;
-        if (!HS_IS_ON_FREQ(p, inst->arena, inst->player->pkt.freq))
-            continue;
-        if (p->flags.is_dead)
-            continue;
-        
         OverrideArenaData *adata = P_ARENA_DATA(inst->arena, adkey);
         if (!adata->spawner) continue;        
         
+        // Only take back what this instance applied, other instances may still be applying the same overrides
         InstancePlayerData *ipdata = HashGetOne(inst->data, p->name);
-        LinkedList *overrides = HashGetOne(&inst->type->properties, "overrides");
+        if (!ipdata)
+            continue;
+        
+        LinkedList *overrides = HashGetOne(inst->type->properties, "overrides");
         
         RemoveOverrides(p, overrides);
         adata->spawner->resendOverrides(p);
+        HS_FIELD_TRACE(fields, inst, TraceOverrideResend, p->pid, 0);
+        fields->AddStat(inst->arena, StatOverrideResends, 1);
     }
     pd->Unlock();
     
@@ -197,8 +216,9 @@ local void OnPlayerAction(Player *p, int action, Arena *a) {
     if (action == PA_ENTERARENA) {
         pdata->overrides = HashAlloc();
     } else if (action == PA_LEAVEARENA) {
-        HashEnum(pdata->overrides, hash_enum_afree, NULL);
+        // The entries belong to the field types' properties
         HashFree(pdata->overrides);
+        pdata->overrides = NULL;
     }
 }
 
@@ -261,12 +281,16 @@ local void ReleaseInterfaces() {
     }
 }
 
+/**
+ * Each field type gets its own overrides, so sets are never shared between types or arenas.
+ */
 HSFieldClass override_class = {
     OverridePropertyLoader,
     OverridePropertyCleanup,
     OverrideInstanceConstructor,
     OverrideInstanceUpdate,
-    OverrideInstanceDestructor
+    OverrideInstanceDestructor,
+    NULL
 };
 
 local Ahscorespawner myspawner = {
@@ -20,11 +20,51 @@ local Ihscoreitems *items;
 
 typedef struct {
     ticks_t end_time;
+    
+    /**
+     * The prize and count the player was given. ?reloadfields may change the type's properties while the
+     * instance lives, so these are what gets taken back.
+     */
+    int prize;
+    int count;
 } PrizePlayerData;
 
-/*********************************/
+/**
+ * What a prize field type gives, stored in the type properties as "prize".
+ */
+typedef struct {
+    /**
+     * The prize given to players inside. Taken away again by giving its negative.
+     */
+    int prize;
+    
+    /**
+     * How many of the prize to give.
+     */
+    int count;
+    
+    /**
+     * Ticks a player keeps the prize after leaving the field.
+     */
+    int time;
+} PrizeProperties;
 
-#define PRIZE_TIME 100
+/**
+ * The prizes being taken back by RevokePrizes, batched like the grants.
+ */
+typedef struct {
+    HSFieldInstance *inst;
+    ticks_t tick;
+    
+    /**
+     * Non-zero to take back every prize, not just the ones that ran out.
+     */
+    int all;
+    
+    Target target;
+    int prize;
+    int count;
+} PrizeRevoke;
 
 /*********************************/
 
@@ -32,14 +72,23 @@ typedef struct {
  * Class property loader called by each field type created of this class.
  */
 local void PrizePropertyLoader(Arena *arena, const char *section, HashTable *properties) {
-    
+    PrizeProperties *props = amalloc(sizeof(PrizeProperties));
+
+    props->prize = cfg->GetInt(arena->cfg, section, "prize", 10);
+    props->count = cfg->GetInt(arena->cfg, section, "prizecount", 1);
+    props->time = cfg->GetInt(arena->cfg, section, "prizetime", 100);
+
+    HashAdd(properties, "prize", props);
 }
 
 /**
  * Frees up memory used by the field type. Called when the field type is removed from the arena.
  */
 local void PrizePropertyCleanup(Arena *arena, HashTable *properties) {
-    
+    PrizeProperties *props = HashGetOne(properties, "prize");
+
+    HashRemoveAny(properties, "prize");
+    afree(props);
 }
 
 /**
@@ -50,24 +99,74 @@ local void PrizeInstanceConstructor(HSFieldInstance *inst) {
 }
 
 /**
- * Called when a field instance gets updated.
+ * HashEnum callback for RevokePrizes. Takes back one player's prize if it ran out, and drops their entry.
  */
-local void PrizeInstanceUpdate(HSFieldInstance *inst) {
+local int RevokeExpired(const char *name, void *val, void *clos) {
+    PrizeRevoke *revoke = (PrizeRevoke *)clos;
+    PrizePlayerData *pdata = (PrizePlayerData *)val;
     Player *p;
-    Link *link;
-
-    pd->Lock();
-    FOR_EACH_PLAYER_IN_ARENA(p, inst->arena) {
-        if (HS_IS_SPEC(p))
-            continue;
-        if (!HS_IS_ON_FREQ(p, inst->arena, inst->player->pkt.freq))
-            continue;
-        if (p->flags.is_dead)
-            continue;
+
+    if (!revoke->all && TICK_DIFF(revoke->tick, pdata->end_time) < 0)
+        return 0;
+
+    // Players who left the arena lost the prize with it
+    p = pd->FindPlayer(name);
+    if (p && p->arena == revoke->inst->arena) {
+        // Players given something else before a reload can't share the batch, take theirs back on its own
+        if (!LLGetHead(&revoke->target.u.list) || (pdata->prize == revoke->prize && pdata->count == revoke->count)) {
+            revoke->prize = pdata->prize;
+            revoke->count = pdata->count;
+            LLAdd(&revoke->target.u.list, p);
+        } else {
+            Target single;
+            single.type = T_PLAYER;
+            single.u.p = p;
+            fields->GivePrize(revoke->inst, &single, -pdata->prize, -pdata->count);
+        }
+    }
+
+    afree(pdata);
+    return 1;
+}
+
+/**
+ * Takes back the prizes that ran out by tick, or all of them if all is set. Goes by the players in the instance
+ * data rather than the freq, so players who died, specced or changed freq since they were prized still lose it.
+ */
+local void RevokePrizes(HSFieldInstance *inst, ticks_t tick, int all) {
+    PrizeRevoke revoke;
+
+    memset(&revoke, 0, sizeof(revoke));
+    revoke.inst = inst;
+    revoke.tick = tick;
+    revoke.all = all;
+    revoke.target.type = T_LIST;
+    LLInit(&revoke.target.u.list);
+
+    HashEnum(inst->data, RevokeExpired, &revoke);
+
+    if (LLGetHead(&revoke.target.u.list))
+        fields->GivePrize(inst, &revoke.target, -revoke.prize, -revoke.count);
+    LLEmpty(&revoke.target.u.list);
+}
+
+/**
+ * Called when a field instance gets updated. Grants and revocations are each sent as one prize to a list of players.
+ */
+local void PrizeInstanceUpdate(HSFieldInstance *inst) {
+    const HSFieldSnapshot *snap = fields->GetSnapshot(inst->arena);
+    PrizeProperties *props = HashGetOne(inst->type->properties, "prize");
+    Target grants;
+
+    grants.type = T_LIST;
+    LLInit(&grants.u.list);
+
+    HS_FOR_SAME_FREQ(snap, inst->freq, i) {
+        Player *p = snap->players[i];
         
         // Update if they are inside the field
-        if (InSquare(p->arena, p->p_ship, inst->x, inst->y, inst->type->radius, p->position.x, p->position.y)) {
-            int bounce = items->getPropertySum(p, p->p_ship, "bounce", 0);
+        if (HS_IN_FIELD(inst, snap, i)) {
+            int bounce = items->getPropertySum(p, snap->ship[i], "bounce", 0);
             
             if (bounce > 0) continue;
             
@@ -76,62 +175,34 @@ local void PrizeInstanceUpdate(HSFieldInstance *inst) {
             if (!pdata) {
                 // Only prize them if they aren't already prized
                 pdata = amalloc(sizeof(PrizePlayerData));
+                pdata->prize = props->prize;
+                pdata->count = props->count;
                 HashAdd(inst->data, p->name, pdata);
-            
-                Target target;
-                target.type = T_PLAYER;
-                target.u.p = p;
-                
-                game->GivePrize(&target, 10, 1);
+                LLAdd(&grants.u.list, p);
+                fields->RecordHit(inst, snap->x[i], snap->y[i]);
             }
             
             // set or reset end timer if they are inside the field
-            pdata->end_time = current_ticks() + PRIZE_TIME;
-        }
-        
-        // Check if any players need to be deprized
-        PrizePlayerData *remdata = HashGetOne(inst->data, p->name);
-        if (remdata) {
-            if (current_ticks() >= remdata->end_time) {
-                HashRemove(inst->data, p->name, remdata);
-                afree(remdata);
-                Target target;
-                target.type = T_PLAYER;
-                target.u.p = p;
-                game->GivePrize(&target, -10, -1);
-            }
+            pdata->end_time = snap->tick + props->time;
         }
     }
-    pd->Unlock();
+
+    if (LLGetHead(&grants.u.list)) {
+        fields->GivePrize(inst, &grants, props->prize, props->count);
+        fields->AddStat(inst->arena, StatPrizeGrants, LLCount(&grants.u.list));
+    }
+    LLEmpty(&grants.u.list);
+
+    // Check if any players need to be deprized
+    RevokePrizes(inst, snap->tick, 0);
 }
 
 /**
  * Called when a field instance is destroyed.
  */
 void PrizeInstanceDestructor(HSFieldInstance *inst) {
-    // remove any prizes
-    Player *p;
-    Link *link;
-    pd->Lock();
-    FOR_EACH_PLAYER_IN_ARENA(p, inst->arena) {
-        if (HS_IS_SPEC(p))
-            continue;
-        if (!HS_IS_ON_FREQ(p, inst->arena, inst->player->pkt.freq))
-            continue;
-        if (p->flags.is_dead)
-            continue;
-            
-        PrizePlayerData *pdata = HashGetOne(inst->data, p->name);
-        if (pdata) {
-            Target target;
-            target.type = T_PLAYER;
-            target.u.p = p;
-            game->GivePrize(&target, -10, -1);
-        }
-    }
-    pd->Unlock();
-    
-    HashEnum(inst->data, hash_enum_afree, NULL);
+    // remove any prizes, outside an update this gives them right away
+    RevokePrizes(inst, current_ticks(), 1);
     HashFree(inst->data);
 }
 
@@ -180,12 +251,20 @@ local void ReleaseInterfaces() {
     }
 }
 
+/**
+ * The config keys read by PrizePropertyLoader.
+ */
+local const char * const prize_keys[] = {
+    "prize", "prizecount", "prizetime", NULL
+};
+
 HSFieldClass prize_class = {
     PrizePropertyLoader,
     PrizePropertyCleanup,
     PrizeInstanceConstructor,
     PrizeInstanceUpdate,
-    PrizeInstanceDestructor
+    PrizeInstanceDestructor,
+    prize_keys
 };
 
 EXPORT const char info_hs_prizefields[] = "v1.0 by monkey, based on hs_field v1.01 by Arnk Kilo Dylie <orbfighter@rshl.org>";